@@ -0,0 +1,216 @@
+#include "assetmemory.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <vector>
+
+// Struct to hold one texture of a material
+struct TextureMemory
+{
+	std::string material;
+	std::string name;
+	unsigned int width = 0;
+	unsigned int height = 0;
+	unsigned int levels = 0; // mip levels, including the base level
+	unsigned long long bytes = 0; // every level
+};
+
+// Struct to hold the memory an import used and let go of again
+struct ImportMemory
+{
+	unsigned long long scenePeak = 0; // largest the importer's scene got, over reading and post processing
+	unsigned long long temporaryPeak = 0; // largest the loader's own buffers got, vectors and decoded images
+	unsigned long long totalPeak = 0; // largest both were at the same time
+};
+
+// Struct to hold the memory of one loaded asset
+struct AssetMemory
+{
+	std::string name;
+	std::vector<MeshMemory> meshes;
+	std::vector<TextureMemory> textures;
+	ImportMemory import;
+};
+
+static std::vector<AssetMemory> assetMemory;
+
+// Bytes per texel for the uncompressed formats we create. Unsized formats are counted as their usual sized format.
+static unsigned int TexelSize(GLenum internalFormat)
+{
+	switch (internalFormat)
+	{
+	case GL_RED:
+	case GL_R8:
+		return 1;
+	case GL_RG:
+	case GL_RG8:
+	case GL_R16F:
+		return 2;
+	case GL_RGB:
+	case GL_RGB8:
+	case GL_SRGB:
+	case GL_SRGB8:
+		return 3;
+	case GL_RGBA:
+	case GL_RGBA8:
+	case GL_SRGB_ALPHA:
+	case GL_SRGB8_ALPHA8:
+	case GL_RGB10_A2:
+	case GL_R32F:
+	case GL_DEPTH_COMPONENT24:
+	case GL_DEPTH24_STENCIL8:
+		return 4;
+	case GL_RGBA16F:
+		return 8;
+	case GL_RGBA32F:
+		return 16;
+	default:
+		return 4;
+	}
+}
+
+// Kilobytes, for printing
+static double KB(unsigned long long bytes)
+{
+	return bytes / 1024.0;
+}
+
+// Current record, opened by BeginAssetMemory
+static AssetMemory& CurrentAsset()
+{
+	if (assetMemory.empty())
+		BeginAssetMemory("unnamed");
+
+	return assetMemory.back();
+}
+
+void BeginAssetMemory(const std::string& name)
+{
+	AssetMemory asset;
+	asset.name = name;
+	assetMemory.push_back(asset);
+}
+
+void AddMeshMemory(const MeshMemory& mesh)
+{
+	CurrentAsset().meshes.push_back(mesh);
+}
+
+void AddTextureMemory(const std::string& material, const std::string& name, unsigned int width, unsigned int height, GLenum internalFormat, bool mipmapped)
+{
+	TextureMemory texture;
+	texture.material = material;
+	texture.name = name;
+	texture.width = width;
+	texture.height = height;
+	texture.bytes = TextureBytes(width, height, internalFormat, mipmapped, texture.levels);
+
+	CurrentAsset().textures.push_back(texture);
+}
+
+void NoteImportMemory(unsigned long long sceneBytes, unsigned long long temporaryBytes)
+{
+	ImportMemory& import = CurrentAsset().import;
+	import.scenePeak = std::max(import.scenePeak, sceneBytes);
+	import.temporaryPeak = std::max(import.temporaryPeak, temporaryBytes);
+	import.totalPeak = std::max(import.totalPeak, sceneBytes + temporaryBytes);
+}
+
+void RemoveAssetMemory(const std::string& name)
+{
+	for (unsigned int i = 0; i < assetMemory.size(); i++)
+	{
+		if (assetMemory[i].name == name)
+		{
+			assetMemory.erase(assetMemory.begin() + i);
+			break;
+		}
+	}
+}
+
+unsigned long long TextureBytes(unsigned int width, unsigned int height, GLenum internalFormat, bool mipmapped, unsigned int& levels)
+{
+	unsigned long long bytes = 0;
+	levels = 0;
+
+	if (width == 0 || height == 0)
+		return 0;
+
+	// Each level halves both sides, rounding down, until both are 1
+	while (true)
+	{
+		bytes += (unsigned long long)width * height * TexelSize(internalFormat);
+		levels++;
+
+		if (!mipmapped || (width == 1 && height == 1))
+			break;
+
+		width = std::max(width / 2, 1u);
+		height = std::max(height / 2, 1u);
+	}
+
+	return bytes;
+}
+
+void PrintAssetMemory(std::ostream& out)
+{
+	unsigned long long allGPUBytes = 0, allCPUBytes = 0;
+
+	// Leave the caller's stream formatted as it was
+	std::ios::fmtflags flags = out.flags();
+	std::streamsize precision = out.precision();
+
+	out << std::fixed << std::setprecision(1);
+
+	for (const AssetMemory& asset : assetMemory)
+	{
+		unsigned long long meshBytes = 0, textureBytes = 0, cpuBytes = 0;
+
+		out << "Asset memory: " << asset.name << std::endl;
+
+		if (!asset.meshes.empty())
+		{
+			out << "  " << std::left << std::setw(24) << "Mesh" << std::right << std::setw(11) << "Index KB" << std::setw(11) << "Vertex KB"
+				<< std::setw(11) << "UV KB" << std::setw(11) << "CPU KB" << std::endl;
+
+			for (const MeshMemory& mesh : asset.meshes)
+			{
+				out << "  " << std::left << std::setw(24) << mesh.name << std::right << std::setw(11) << KB(mesh.indexBytes) << std::setw(11) << KB(mesh.vertexBytes)
+					<< std::setw(11) << KB(mesh.uvBytes) << std::setw(11) << KB(mesh.cpuBytes) << std::endl;
+
+				meshBytes += mesh.indexBytes + mesh.vertexBytes + mesh.uvBytes;
+				cpuBytes += mesh.cpuBytes;
+			}
+		}
+
+		if (!asset.textures.empty())
+		{
+			out << "  " << std::left << std::setw(24) << "Material" << std::setw(32) << "Texture" << std::right << std::setw(12) << "Size" << std::setw(8) << "Levels"
+				<< std::setw(11) << "KB" << std::endl;
+
+			for (const TextureMemory& texture : asset.textures)
+			{
+				std::ostringstream size;
+				size << texture.width << "x" << texture.height;
+
+				out << "  " << std::left << std::setw(24) << texture.material << std::setw(32) << texture.name << std::right << std::setw(12) << size.str()
+					<< std::setw(8) << texture.levels << std::setw(11) << KB(texture.bytes) << std::endl;
+
+				textureBytes += texture.bytes;
+			}
+		}
+
+		out << "  GPU: " << KB(meshBytes + textureBytes) << " KB (meshes " << KB(meshBytes) << " KB, textures " << KB(textureBytes) << " KB), CPU kept: " << KB(cpuBytes) << " KB" << std::endl;
+		out << "  Import peak: scene " << KB(asset.import.scenePeak) << " KB, temporary " << KB(asset.import.temporaryPeak) << " KB, together " << KB(asset.import.totalPeak) << " KB" << std::endl;
+
+		allGPUBytes += meshBytes + textureBytes;
+		allCPUBytes += cpuBytes;
+	}
+
+	out << "All assets: GPU " << KB(allGPUBytes) << " KB, CPU kept " << KB(allCPUBytes) << " KB" << std::endl;
+
+	out.flags(flags);
+	out.precision(precision);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <ostream>
+#include <string>
+
+// Struct to hold what one mesh keeps, on the GPU in the geometry pool and on the CPU
+struct MeshMemory
+{
+	std::string name;
+	unsigned long long indexBytes = 0;
+	unsigned long long vertexBytes = 0; // positions
+	unsigned long long uvBytes = 0; // interleaved with the positions, counted apart so the cost of uvs shows
+	unsigned long long cpuBytes = 0; // copies kept on the CPU, such as occluder triangles
+};
+
+// Memory accounting for loaded assets. Loaders open a record for an asset then add what they create to it.
+// Sizes are worked out from what was asked for, drivers may pad or compress behind our backs.
+// Not thread safe, use from one thread.
+void BeginAssetMemory(const std::string& name); // following calls add to this asset
+void AddMeshMemory(const MeshMemory& mesh);
+void AddTextureMemory(const std::string& material, const std::string& name, unsigned int width, unsigned int height, GLenum internalFormat, bool mipmapped);
+void NoteImportMemory(unsigned long long sceneBytes, unsigned long long temporaryBytes); // raise the import peaks if these are higher
+void RemoveAssetMemory(const std::string& name); // the asset was unloaded
+
+unsigned long long TextureBytes(unsigned int width, unsigned int height, GLenum internalFormat, bool mipmapped, unsigned int& levels); // size of a texture and its mip chain
+void PrintAssetMemory(std::ostream& out); // table per asset, its meshes and textures, with totals
@@ -0,0 +1,169 @@
+#include "culling.h"
+
+#include <cmath>
+
+// Use SSE if the compiler targets it (always the case on x64)
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define CULLING_SSE
+#include <xmmintrin.h>
+#endif
+
+void BoxList::Clear()
+{
+	centerX.clear();
+	centerY.clear();
+	centerZ.clear();
+	extentX.clear();
+	extentY.clear();
+	extentZ.clear();
+}
+
+void BoxList::Add(const glm::vec3& center, const glm::vec3& extent)
+{
+	centerX.push_back(center.x);
+	centerY.push_back(center.y);
+	centerZ.push_back(center.z);
+	extentX.push_back(extent.x);
+	extentY.push_back(extent.y);
+	extentZ.push_back(extent.z);
+}
+
+Frustum ExtractFrustum(const glm::mat4& viewProjection)
+{
+	// Rows of the matrix, glm is column major
+	glm::vec4 row0(viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0]);
+	glm::vec4 row1(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1]);
+	glm::vec4 row2(viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2]);
+	glm::vec4 row3(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+
+	Frustum frustum;
+	frustum.planes[0] = row3 + row0; // left
+	frustum.planes[1] = row3 - row0; // right
+	frustum.planes[2] = row3 + row1; // bottom
+	frustum.planes[3] = row3 - row1; // top
+	frustum.planes[4] = row3 + row2; // near
+	frustum.planes[5] = row3 - row2; // far
+
+	// Normalise, so distances are in world units and sphere radii can be compared against them
+	for (glm::vec4& plane : frustum.planes)
+		plane /= glm::length(glm::vec3(plane));
+
+	return frustum;
+}
+
+void TransformBounds(const Bounds& bounds, const glm::mat4& matrix, glm::vec3& center, glm::vec3& extent)
+{
+	glm::vec3 localCenter = (bounds.minimum + bounds.maximum) * 0.5f;
+	glm::vec3 localExtent = (bounds.maximum - bounds.minimum) * 0.5f;
+
+	center = glm::vec3(matrix * glm::vec4(localCenter, 1.0f));
+
+	// Each axis of the new box is the sum of the old extents projected onto it
+	for (unsigned int i = 0; i < 3; i++)
+		extent[i] = std::fabs(matrix[0][i]) * localExtent.x + std::fabs(matrix[1][i]) * localExtent.y + std::fabs(matrix[2][i]) * localExtent.z;
+}
+
+void TransformSphere(const Bounds& bounds, const glm::mat4& matrix, glm::vec3& center, float& radius)
+{
+	center = glm::vec3(matrix * glm::vec4(bounds.sphereCenter, 1.0f));
+
+	float scale = glm::max(glm::length(glm::vec3(matrix[0])), glm::max(glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2]))));
+	radius = bounds.sphereRadius * scale;
+}
+
+bool SphereInFrustum(const Frustum& frustum, const glm::vec3& center, float radius)
+{
+	for (const glm::vec4& plane : frustum.planes)
+	{
+		if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+			return false;
+	}
+
+	return true;
+}
+
+bool BoxInFrustum(const Frustum& frustum, const glm::vec3& center, const glm::vec3& extent)
+{
+	for (const glm::vec4& plane : frustum.planes)
+	{
+		// Distance of the centre, plus how far the box reaches towards the plane normal
+		float distance = glm::dot(glm::vec3(plane), center) + plane.w;
+		float reach = glm::dot(glm::abs(glm::vec3(plane)), extent);
+
+		if (distance + reach < 0.0f)
+			return false;
+	}
+
+	return true;
+}
+
+unsigned int CullBoxes(const Frustum& frustum, const BoxList& boxes, std::vector<unsigned char>& visible)
+{
+	unsigned int count = boxes.Size();
+	unsigned int visibleCount = 0;
+	unsigned int i = 0;
+
+	visible.resize(count);
+
+#ifdef CULLING_SSE
+	// Broadcast every plane once
+	__m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+	__m128 absX[6], absY[6], absZ[6];
+
+	for (unsigned int p = 0; p < 6; p++)
+	{
+		const glm::vec4& plane = frustum.planes[p];
+		planeX[p] = _mm_set1_ps(plane.x);
+		planeY[p] = _mm_set1_ps(plane.y);
+		planeZ[p] = _mm_set1_ps(plane.z);
+		planeW[p] = _mm_set1_ps(plane.w);
+		absX[p] = _mm_set1_ps(std::fabs(plane.x));
+		absY[p] = _mm_set1_ps(std::fabs(plane.y));
+		absZ[p] = _mm_set1_ps(std::fabs(plane.z));
+	}
+
+	__m128 zero = _mm_setzero_ps();
+
+	// Four boxes at a time, the remainder goes through the scalar test below
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 centerX = _mm_loadu_ps(&boxes.centerX[i]);
+		__m128 centerY = _mm_loadu_ps(&boxes.centerY[i]);
+		__m128 centerZ = _mm_loadu_ps(&boxes.centerZ[i]);
+		__m128 extentX = _mm_loadu_ps(&boxes.extentX[i]);
+		__m128 extentY = _mm_loadu_ps(&boxes.extentY[i]);
+		__m128 extentZ = _mm_loadu_ps(&boxes.extentZ[i]);
+
+		// A lane is set once its box is found to be fully outside any plane
+		__m128 outside = _mm_setzero_ps();
+
+		for (unsigned int p = 0; p < 6; p++)
+		{
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], centerX), _mm_mul_ps(planeY[p], centerY)), _mm_add_ps(_mm_mul_ps(planeZ[p], centerZ), planeW[p]));
+			__m128 reach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(absX[p], extentX), _mm_mul_ps(absY[p], extentY)), _mm_mul_ps(absZ[p], extentZ));
+
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, reach), zero));
+		}
+
+		int mask = _mm_movemask_ps(outside);
+
+		for (unsigned int lane = 0; lane < 4; lane++)
+		{
+			visible[i + lane] = (mask >> lane) & 1 ? 0 : 1;
+			visibleCount += visible[i + lane];
+		}
+	}
+#endif
+
+	// Scalar path, for the last few boxes or without SSE
+	for (; i < count; i++)
+	{
+		glm::vec3 center(boxes.centerX[i], boxes.centerY[i], boxes.centerZ[i]);
+		glm::vec3 extent(boxes.extentX[i], boxes.extentY[i], boxes.extentZ[i]);
+
+		visible[i] = BoxInFrustum(frustum, center, extent) ? 1 : 0;
+		visibleCount += visible[i];
+	}
+
+	return visibleCount;
+}
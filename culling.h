@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+
+#include "maths.h"
+
+// Struct to hold the bounds of a mesh, in its own space
+struct Bounds
+{
+	glm::vec3 minimum;
+	glm::vec3 maximum;
+	glm::vec3 sphereCenter; // bounding sphere, centred on the box
+	float sphereRadius = 0.0f;
+};
+
+// Struct to hold the six planes of a view frustum (left, right, bottom, top, near, far). Planes are
+// normalised with normals pointing inwards, so a point is inside when dot(plane.xyz, point) + plane.w >= 0.
+struct Frustum
+{
+	glm::vec4 planes[6];
+};
+
+// Struct to hold boxes to cull as separate arrays of each component, so four boxes load into one register per component
+struct BoxList
+{
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> extentX, extentY, extentZ; // half sizes
+
+	void Clear();
+	void Add(const glm::vec3& center, const glm::vec3& extent);
+	unsigned int Size() const { return centerX.size(); }
+};
+
+// Gribb-Hartmann plane extraction. With a view projection matrix the planes are in world space, with a
+// model view projection matrix they are in that model's space.
+Frustum ExtractFrustum(const glm::mat4& viewProjection);
+
+// Transform a box by a matrix, returning the centre and half size of the box that encloses the result
+void TransformBounds(const Bounds& bounds, const glm::mat4& matrix, glm::vec3& center, glm::vec3& extent);
+
+// Transform a bounding sphere by a matrix, growing the radius by the matrix's largest scale
+void TransformSphere(const Bounds& bounds, const glm::mat4& matrix, glm::vec3& center, float& radius);
+
+bool SphereInFrustum(const Frustum& frustum, const glm::vec3& center, float radius);
+bool BoxInFrustum(const Frustum& frustum, const glm::vec3& center, const glm::vec3& extent);
+
+// Test every box against the frustum, setting visible[i] to 1 or 0. Uses SSE when available, testing four
+// boxes per plane at once. Conservative: boxes crossing a frustum corner can be kept. Returns the visible count.
+unsigned int CullBoxes(const Frustum& frustum, const BoxList& boxes, std::vector<unsigned char>& visible);
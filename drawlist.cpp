@@ -0,0 +1,99 @@
+#include "drawlist.h"
+
+#include <cmath>
+#include <cstring>
+
+// Key field widths
+static const unsigned int PROGRAM_BITS = 8;
+static const unsigned int MATERIAL_BITS = 12;
+static const unsigned int TEXTURE_BITS = 12;
+static const unsigned int VERTEX_ARRAY_BITS = 16;
+static const unsigned int DEPTH_BITS = 16;
+
+// Append a field to the bottom of the key
+static void PushField(unsigned long long& key, unsigned int value, unsigned int bits)
+{
+	key = (key << bits) | (value & ((1u << bits) - 1));
+}
+
+unsigned long long MakeDrawKey(DrawSortMode mode, unsigned int program, unsigned int material, unsigned int texture, unsigned int vertexArray, unsigned int depth)
+{
+	unsigned long long key = 0;
+
+	// Program switches are the most expensive, so they always go at the top
+	PushField(key, program, PROGRAM_BITS);
+
+	if (mode == SORT_FRONT_TO_BACK)
+		PushField(key, depth, DEPTH_BITS);
+
+	PushField(key, material, MATERIAL_BITS);
+	PushField(key, texture, TEXTURE_BITS);
+	PushField(key, vertexArray, VERTEX_ARRAY_BITS);
+
+	if (mode == SORT_BY_STATE)
+		PushField(key, depth, DEPTH_BITS);
+
+	return key;
+}
+
+unsigned int DepthBucket(float viewDepth, float zNear, float zFar)
+{
+	// Behind the near plane goes first
+	if (viewDepth <= zNear)
+		return 0;
+
+	// Logarithmic distribution between the near and far planes
+	float t = std::log(viewDepth / zNear) / std::log(zFar / zNear);
+
+	if (t >= 1.0f)
+		return (1u << DEPTH_BITS) - 1;
+
+	return (unsigned int)(t * ((1u << DEPTH_BITS) - 1));
+}
+
+void SortDrawList(std::vector<DrawItem>& items, std::vector<DrawItem>& scratch)
+{
+	const unsigned int passes = sizeof(unsigned long long);
+	size_t count = items.size();
+
+	if (count < 2)
+		return;
+
+	// Build the histogram for every byte in one read of the keys
+	unsigned int histograms[passes][256];
+	memset(histograms, 0, sizeof(histograms));
+
+	for (const DrawItem& item : items)
+	{
+		for (unsigned int pass = 0; pass < passes; pass++)
+			histograms[pass][(item.key >> (pass * 8)) & 0xFF]++;
+	}
+
+	scratch.resize(count);
+
+	for (unsigned int pass = 0; pass < passes; pass++)
+	{
+		unsigned int* histogram = histograms[pass];
+		unsigned int shift = pass * 8;
+
+		// Every key has the same byte here, so this pass wouldn't move anything
+		if (histogram[(items[0].key >> shift) & 0xFF] == count)
+			continue;
+
+		// Turn counts into starting offsets
+		unsigned int offset = 0;
+
+		for (unsigned int digit = 0; digit < 256; digit++)
+		{
+			unsigned int digitCount = histogram[digit];
+			histogram[digit] = offset;
+			offset += digitCount;
+		}
+
+		// Scatter, in order, so the sort is stable
+		for (const DrawItem& item : items)
+			scratch[histogram[(item.key >> shift) & 0xFF]++] = item;
+
+		items.swap(scratch);
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <vector>
+
+// How draw keys are ordered
+enum DrawSortMode
+{
+	SORT_BY_STATE, // program, material, texture, vertex array, then depth. Fewest state changes.
+	SORT_FRONT_TO_BACK // program, depth, then material, texture, vertex array. Nearest first, so early-Z rejects hidden fragments.
+};
+
+// Struct to hold one entry in the draw list
+struct DrawItem
+{
+	unsigned long long key; // packed sort key, see MakeDrawKey
+	unsigned int index; // what to draw, e.g. a mesh index
+};
+
+// Pack draw state into a 64 bit key. Fields are truncated to their widths (program 8 bits, material
+// 12, texture 12, vertex array 16, depth 16), which at worst splits a group, never draws wrongly.
+unsigned long long MakeDrawKey(DrawSortMode mode, unsigned int program, unsigned int material, unsigned int texture, unsigned int vertexArray, unsigned int depth);
+
+// Quantise view space depth into a 16 bit bucket. Buckets are logarithmic, so there is more precision close to the camera.
+unsigned int DepthBucket(float viewDepth, float zNear, float zFar);
+
+// Sort a draw list by key with a stable LSD radix sort, 8 bits per pass. Passes where every key has the
+// same byte are skipped, which is most of them for small scenes. scratch is resized as needed, keep it
+// around between frames to avoid allocating.
+void SortDrawList(std::vector<DrawItem>& items, std::vector<DrawItem>& scratch);
@@ -0,0 +1,176 @@
+#include "framestats.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+// Histogram bucket upper bounds in milliseconds, around common frame budgets. The last bucket takes everything above.
+static const double HISTOGRAM_BOUNDS[] = { 2.0, 4.0, 6.0, 8.0, 10.0, 12.0, 14.0, 16.7, 20.0, 25.0, 33.3, 50.0, 100.0 };
+static const unsigned int HISTOGRAM_BUCKETS = sizeof(HISTOGRAM_BOUNDS) / sizeof(HISTOGRAM_BOUNDS[0]) + 1;
+static const unsigned int HISTOGRAM_WIDTH = 40; // characters for the largest bucket
+
+// Struct to hold a rolling window of samples
+struct FrameSeries
+{
+	std::vector<double> samples; // grows to FRAME_STATS_WINDOW, then wraps
+	unsigned int next = 0; // where the next sample goes once full
+};
+
+static FrameSeries frameSeries[FRAME_METRIC_COUNT];
+static std::vector<double> sortedScratch;
+static std::ofstream frameStatsFile;
+
+// Nearest rank percentile of sorted samples
+static double Percentile(const std::vector<double>& sorted, double percent)
+{
+	size_t rank = (size_t)(percent / 100.0 * sorted.size() + 0.5);
+	return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+}
+
+void AddFrameSample(FrameMetric metric, double milliseconds)
+{
+	FrameSeries& series = frameSeries[metric];
+
+	if (series.samples.size() < FRAME_STATS_WINDOW)
+	{
+		series.samples.push_back(milliseconds);
+		return;
+	}
+
+	series.samples[series.next] = milliseconds;
+	series.next = (series.next + 1) % FRAME_STATS_WINDOW;
+}
+
+FrameSummary SummariseFrameMetric(FrameMetric metric)
+{
+	FrameSummary summary;
+	const std::vector<double>& samples = frameSeries[metric].samples;
+
+	if (samples.empty())
+		return summary;
+
+	sortedScratch.assign(samples.begin(), samples.end());
+	std::sort(sortedScratch.begin(), sortedScratch.end());
+
+	double total = 0.0;
+
+	for (double sample : sortedScratch)
+		total += sample;
+
+	summary.count = sortedScratch.size();
+	summary.minimum = sortedScratch.front();
+	summary.mean = total / summary.count;
+	summary.p50 = Percentile(sortedScratch, 50.0);
+	summary.p95 = Percentile(sortedScratch, 95.0);
+	summary.p99 = Percentile(sortedScratch, 99.0);
+	summary.maximum = sortedScratch.back();
+
+	return summary;
+}
+
+const char* FrameMetricName(FrameMetric metric)
+{
+	const char* names[FRAME_METRIC_COUNT] = { "cpu", "gpu", "present" };
+	return names[metric];
+}
+
+// Print a histogram of a metric's samples, skipping the empty buckets at either end
+static void PrintHistogram(FrameMetric metric)
+{
+	unsigned int counts[HISTOGRAM_BUCKETS] = { 0 };
+
+	for (double sample : frameSeries[metric].samples)
+		counts[std::lower_bound(HISTOGRAM_BOUNDS, HISTOGRAM_BOUNDS + HISTOGRAM_BUCKETS - 1, sample) - HISTOGRAM_BOUNDS]++;
+
+	unsigned int first = 0, last = HISTOGRAM_BUCKETS - 1;
+
+	while (first < last && counts[first] == 0)
+		first++;
+
+	while (last > first && counts[last] == 0)
+		last--;
+
+	unsigned int largest = *std::max_element(counts, counts + HISTOGRAM_BUCKETS);
+
+	for (unsigned int i = first; i <= last; i++)
+	{
+		std::ostringstream range;
+
+		if (i == HISTOGRAM_BUCKETS - 1)
+			range << "> " << HISTOGRAM_BOUNDS[i - 1];
+		else
+			range << "<= " << HISTOGRAM_BOUNDS[i];
+
+		unsigned int bar = largest > 0 ? (counts[i] * HISTOGRAM_WIDTH + largest - 1) / largest : 0;
+		std::cout << "  " << std::setw(8) << range.str() << " ms " << std::setw(6) << counts[i] << " " << std::string(bar, '#') << std::endl;
+	}
+}
+
+void PrintFrameStats()
+{
+	std::cout << std::left << std::setw(10) << "Frame ms" << std::right << std::setw(8) << "Count" << std::setw(9) << "Min" << std::setw(9) << "Mean"
+		<< std::setw(9) << "p50" << std::setw(9) << "p95" << std::setw(9) << "p99" << std::setw(9) << "Max" << std::endl;
+	std::cout << std::fixed << std::setprecision(2);
+
+	for (unsigned int i = 0; i < FRAME_METRIC_COUNT; i++)
+	{
+		FrameSummary summary = SummariseFrameMetric((FrameMetric)i);
+
+		if (summary.count == 0)
+			continue;
+
+		std::cout << std::left << std::setw(10) << FrameMetricName((FrameMetric)i) << std::right << std::setw(8) << summary.count << std::setw(9) << summary.minimum << std::setw(9) << summary.mean
+			<< std::setw(9) << summary.p50 << std::setw(9) << summary.p95 << std::setw(9) << summary.p99 << std::setw(9) << summary.maximum << std::endl;
+	}
+
+	std::cout.unsetf(std::ios::floatfield);
+	std::cout << std::setprecision(6);
+
+	for (unsigned int i = 0; i < FRAME_METRIC_COUNT; i++)
+	{
+		if (frameSeries[i].samples.empty())
+			continue;
+
+		std::cout << FrameMetricName((FrameMetric)i) << " histogram:" << std::endl;
+		PrintHistogram((FrameMetric)i);
+	}
+}
+
+bool OpenFrameStatsFile(const std::string& filename)
+{
+	frameStatsFile.open(filename.c_str());
+
+	if (!frameStatsFile)
+		return false;
+
+	frameStatsFile << "time_s,metric,count,min_ms,mean_ms,p50_ms,p95_ms,p99_ms,max_ms" << std::endl;
+	frameStatsFile << std::fixed << std::setprecision(3);
+
+	return true;
+}
+
+void WriteFrameStats(double seconds)
+{
+	if (!frameStatsFile.is_open())
+		return;
+
+	for (unsigned int i = 0; i < FRAME_METRIC_COUNT; i++)
+	{
+		FrameSummary summary = SummariseFrameMetric((FrameMetric)i);
+
+		if (summary.count == 0)
+			continue;
+
+		frameStatsFile << seconds << "," << FrameMetricName((FrameMetric)i) << "," << summary.count << "," << summary.minimum << "," << summary.mean << ","
+			<< summary.p50 << "," << summary.p95 << "," << summary.p99 << "," << summary.maximum << std::endl;
+	}
+}
+
+void CloseFrameStatsFile()
+{
+	if (frameStatsFile.is_open())
+		frameStatsFile.close();
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+
+// Frames kept for the statistics, older ones roll out
+const unsigned int FRAME_STATS_WINDOW = 600;
+
+// What is measured every frame, all in milliseconds
+enum FrameMetric
+{
+	FRAME_METRIC_CPU, // CPU work for the frame, the slower of the main and render threads, not counting waits
+	FRAME_METRIC_GPU, // GPU time from the start to the end of the frame's commands, arrives a few frames late
+	FRAME_METRIC_PRESENT, // present to present interval
+	FRAME_METRIC_COUNT
+};
+
+// Struct to hold statistics of a metric over the window
+struct FrameSummary
+{
+	unsigned int count = 0;
+	double minimum = 0.0;
+	double mean = 0.0;
+	double p50 = 0.0;
+	double p95 = 0.0;
+	double p99 = 0.0;
+	double maximum = 0.0;
+};
+
+// Frame statistics collector. Samples go into a fixed size rolling window per metric, summaries are
+// worked out from a sorted copy when asked for. Not thread safe, use from one thread.
+void AddFrameSample(FrameMetric metric, double milliseconds);
+FrameSummary SummariseFrameMetric(FrameMetric metric);
+const char* FrameMetricName(FrameMetric metric);
+
+void PrintFrameStats(); // summary and histogram of every metric
+bool OpenFrameStatsFile(const std::string& filename); // CSV, one row per metric each time WriteFrameStats is called. False if the file couldn't be opened.
+void WriteFrameStats(double seconds); // summary rows, stamped with the time since startup
+void CloseFrameStatsFile();
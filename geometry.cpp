@@ -0,0 +1,269 @@
+#include "geometry.h"
+#include "glstate.h"
+#include "shader.h"
+
+#include <vector>
+
+// Smallest buffer sizes, buffers double from here when they run out of space
+static const GLsizeiptr MINIMUM_VERTEX_BUFFER_SIZE = 4 * 1024 * 1024;
+static const GLsizeiptr MINIMUM_INDEX_BUFFER_SIZE = 4 * 1024 * 1024;
+
+// Struct to hold a growable buffer that allocations are appended to
+struct PoolBuffer
+{
+	GLuint buffer = 0;
+	GLsizeiptr size = 0; // capacity in bytes
+	GLsizeiptr used = 0; // bytes allocated
+};
+
+// One vertex buffer and vertex array per format, one index buffer for everything
+static PoolBuffer vertexPools[VERTEX_FORMAT_COUNT];
+static GLuint vertexArrays[VERTEX_FORMAT_COUNT] = { 0 };
+static PoolBuffer indexPool;
+
+// Struct to hold a vertex array that reads instance data as well as pool geometry
+struct InstancedVertexArray
+{
+	GLuint vertexArray;
+	VertexFormat format;
+	GLuint instanceBuffer;
+	GLsizeiptr offset;
+};
+
+static std::vector<InstancedVertexArray> instancedVertexArrays;
+
+unsigned int VertexFormatStride(VertexFormat format)
+{
+	switch (format)
+	{
+	case VERTEX_FORMAT_POSITION:
+		return 3 * sizeof(float);
+	case VERTEX_FORMAT_POSITION_UV:
+		return 5 * sizeof(float);
+	default:
+		return 0;
+	}
+}
+
+// Point a vertex array at a format's vertex buffer and the index buffer. Leaves the vertex array bound.
+static void SetupGeometryAttributes(GLuint vertexArray, VertexFormat format)
+{
+	GLsizei stride = VertexFormatStride(format);
+
+	StateBindVertexArray(vertexArray);
+	StateBindBuffer(GL_ARRAY_BUFFER, vertexPools[format].buffer);
+
+	// Position is always first
+	glEnableVertexAttribArray(VERTEX_ATTRIB);
+	glVertexAttribPointer(VERTEX_ATTRIB, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+
+	if (format == VERTEX_FORMAT_POSITION_UV)
+	{
+		glEnableVertexAttribArray(UV_ATTRIB);
+		glVertexAttribPointer(UV_ATTRIB, 2, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
+	}
+
+	StateBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexPool.buffer);
+}
+
+// Point a vertex array at instance data, advancing once per instance
+static void SetupInstanceAttributes(GLuint instanceBuffer, GLsizeiptr offset)
+{
+	GLsizei stride = sizeof(InstanceData);
+
+	StateBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+
+	// A mat4 attribute takes four consecutive locations, one per column
+	for (GLuint column = 0; column < 4; column++)
+	{
+		glEnableVertexAttribArray(INSTANCE_MATRIX_ATTRIB + column);
+		glVertexAttribPointer(INSTANCE_MATRIX_ATTRIB + column, 4, GL_FLOAT, GL_FALSE, stride, (void*)(offset + column * sizeof(glm::vec4)));
+		glVertexAttribDivisor(INSTANCE_MATRIX_ATTRIB + column, 1);
+	}
+
+	glEnableVertexAttribArray(INSTANCE_COLOR_ATTRIB);
+	glVertexAttribPointer(INSTANCE_COLOR_ATTRIB, 4, GL_FLOAT, GL_FALSE, stride, (void*)(offset + sizeof(glm::mat4)));
+	glVertexAttribDivisor(INSTANCE_COLOR_ATTRIB, 1);
+}
+
+// Set up a format's shared vertex array, and every instanced vertex array of that format
+static void SetupVertexArray(VertexFormat format)
+{
+	if (vertexArrays[format] == 0)
+		glGenVertexArrays(1, &vertexArrays[format]);
+
+	SetupGeometryAttributes(vertexArrays[format], format);
+
+	for (const InstancedVertexArray& instanced : instancedVertexArrays)
+	{
+		if (instanced.format == format)
+		{
+			SetupGeometryAttributes(instanced.vertexArray, format);
+			SetupInstanceAttributes(instanced.instanceBuffer, instanced.offset);
+		}
+	}
+
+	StateBindVertexArray(0);
+}
+
+// Make sure a pool buffer can take size more bytes, moving it into a bigger buffer if not. Returns true if the buffer changed.
+static bool ReserveSpace(PoolBuffer& pool, GLsizeiptr size, GLsizeiptr minimumSize)
+{
+	if (pool.used + size <= pool.size)
+		return false;
+
+	// Double until it fits
+	GLsizeiptr newSize = pool.size > 0 ? pool.size : minimumSize;
+
+	while (pool.used + size > newSize)
+		newSize *= 2;
+
+	// New buffer, copy across what we already have, on the GPU
+	GLuint newBuffer;
+	glGenBuffers(1, &newBuffer);
+	StateBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+	StateBufferData(GL_COPY_WRITE_BUFFER, newSize, NULL, GL_STATIC_DRAW);
+
+	if (pool.buffer != 0)
+	{
+		if (pool.used > 0)
+		{
+			StateBindBuffer(GL_COPY_READ_BUFFER, pool.buffer);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, pool.used);
+		}
+
+		StateDeleteBuffers(1, &pool.buffer);
+	}
+
+	pool.buffer = newBuffer;
+	pool.size = newSize;
+
+	return true;
+}
+
+// Append data to a pool buffer, returning its byte offset. Uploads go through the copy target so no vertex array is needed.
+static GLsizeiptr Append(PoolBuffer& pool, const void* data, GLsizeiptr size)
+{
+	GLsizeiptr offset = pool.used;
+
+	StateBindBuffer(GL_COPY_WRITE_BUFFER, pool.buffer);
+	StateBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data);
+	pool.used += size;
+
+	return offset;
+}
+
+GeometryAllocation AllocateGeometry(VertexFormat format, const void* vertices, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount)
+{
+	GLsizeiptr stride = VertexFormatStride(format);
+	GLsizeiptr vertexSize = stride * vertexCount;
+	GLsizeiptr indexSize = sizeof(unsigned int) * indexCount;
+
+	// Grow the buffers if needed. If the index buffer moved every vertex array needs it attaching again.
+	bool vertexBufferMoved = ReserveSpace(vertexPools[format], vertexSize, MINIMUM_VERTEX_BUFFER_SIZE);
+
+	if (ReserveSpace(indexPool, indexSize, MINIMUM_INDEX_BUFFER_SIZE))
+	{
+		for (unsigned int i = 0; i < VERTEX_FORMAT_COUNT; i++)
+		{
+			if (vertexArrays[i] != 0 && i != format)
+				SetupVertexArray((VertexFormat)i);
+		}
+
+		vertexBufferMoved = true;
+	}
+
+	if (vertexBufferMoved || vertexArrays[format] == 0)
+		SetupVertexArray(format);
+
+	// Vertices are aligned to the stride, so the offset is a whole number of vertices
+	vertexPools[format].used = (vertexPools[format].used + stride - 1) / stride * stride;
+
+	GeometryAllocation allocation;
+	allocation.format = format;
+	allocation.baseVertex = Append(vertexPools[format], vertices, vertexSize) / stride;
+	allocation.vertexCount = vertexCount;
+	allocation.firstIndex = Append(indexPool, indices, indexSize) / sizeof(unsigned int);
+	allocation.indexCount = indexCount;
+
+	return allocation;
+}
+
+GLuint GetGeometryVertexArray(VertexFormat format)
+{
+	return vertexArrays[format];
+}
+
+GLuint CreateInstancedVertexArray(VertexFormat format, GLuint instanceBuffer, GLsizeiptr offset)
+{
+	InstancedVertexArray instanced;
+	instanced.format = format;
+	instanced.instanceBuffer = instanceBuffer;
+	instanced.offset = offset;
+	glGenVertexArrays(1, &instanced.vertexArray);
+
+	SetupGeometryAttributes(instanced.vertexArray, format);
+	SetupInstanceAttributes(instanceBuffer, offset);
+	StateBindVertexArray(0);
+
+	// Remember it, so it can be pointed at the new buffers if the pool grows
+	instancedVertexArrays.push_back(instanced);
+
+	return instanced.vertexArray;
+}
+
+void DeleteInstancedVertexArray(GLuint vertexArray)
+{
+	for (unsigned int i = 0; i < instancedVertexArrays.size(); i++)
+	{
+		if (instancedVertexArrays[i].vertexArray == vertexArray)
+		{
+			instancedVertexArrays.erase(instancedVertexArrays.begin() + i);
+			break;
+		}
+	}
+
+	StateDeleteVertexArrays(1, &vertexArray);
+}
+
+void DrawGeometry(const GeometryAllocation& allocation)
+{
+	StateDrawElementsBaseVertex(GL_TRIANGLES, allocation.indexCount, GL_UNSIGNED_INT, (void*)(allocation.firstIndex * sizeof(unsigned int)), allocation.baseVertex);
+}
+
+void GetGeometryPoolBytes(unsigned long long& used, unsigned long long& allocated)
+{
+	used = indexPool.used;
+	allocated = indexPool.size;
+
+	for (unsigned int i = 0; i < VERTEX_FORMAT_COUNT; i++)
+	{
+		used += vertexPools[i].used;
+		allocated += vertexPools[i].size;
+	}
+}
+
+void DestroyGeometryPools()
+{
+	for (unsigned int i = 0; i < VERTEX_FORMAT_COUNT; i++)
+	{
+		if (vertexArrays[i] != 0)
+			StateDeleteVertexArrays(1, &vertexArrays[i]);
+
+		if (vertexPools[i].buffer != 0)
+			StateDeleteBuffers(1, &vertexPools[i].buffer);
+
+		vertexArrays[i] = 0;
+		vertexPools[i] = PoolBuffer();
+	}
+
+	for (const InstancedVertexArray& instanced : instancedVertexArrays)
+		StateDeleteVertexArrays(1, &instanced.vertexArray);
+
+	instancedVertexArrays.clear();
+
+	if (indexPool.buffer != 0)
+		StateDeleteBuffers(1, &indexPool.buffer);
+
+	indexPool = PoolBuffer();
+}
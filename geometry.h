@@ -0,0 +1,47 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include "maths.h"
+
+// Vertex layouts. Each format has one large interleaved vertex buffer and one vertex array object,
+// shared by every mesh with that layout.
+enum VertexFormat
+{
+	VERTEX_FORMAT_POSITION, // vec3 position
+	VERTEX_FORMAT_POSITION_UV, // vec3 position, vec2 uv
+	VERTEX_FORMAT_COUNT
+};
+
+// Struct to hold a mesh's share of the geometry pool
+struct GeometryAllocation
+{
+	VertexFormat format = VERTEX_FORMAT_POSITION;
+	unsigned int firstIndex = 0; // offset into the shared index buffer, in indices
+	unsigned int indexCount = 0;
+	int baseVertex = 0; // offset into the format's vertex buffer, in vertices. Indices are relative to this.
+	unsigned int vertexCount = 0;
+};
+
+// Struct to hold per instance (or per draw) data, read by the instanceMatrix and instanceColor attributes with a divisor of 1
+struct InstanceData
+{
+	glm::mat4 matrix;
+	glm::vec4 color;
+};
+
+unsigned int VertexFormatStride(VertexFormat format); // size of one vertex in bytes
+
+// Copy interleaved vertices and mesh-relative indices into the pool. Buffers grow as needed.
+GeometryAllocation AllocateGeometry(VertexFormat format, const void* vertices, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount);
+
+GLuint GetGeometryVertexArray(VertexFormat format); // vertex array object for a format, with the shared index buffer attached
+
+// Vertex array object for a format that also reads InstanceData from instanceBuffer, one element per instance.
+// Kept up to date if the pool grows. Select where reading starts with baseInstance, or offset.
+GLuint CreateInstancedVertexArray(VertexFormat format, GLuint instanceBuffer, GLsizeiptr offset = 0);
+void DeleteInstancedVertexArray(GLuint vertexArray);
+void DrawGeometry(const GeometryAllocation& allocation); // glDrawElementsBaseVertex, the format's vertex array must be bound
+
+void GetGeometryPoolBytes(unsigned long long& used, unsigned long long& allocated); // over every pool, allocated includes the room left to grow into
+void DestroyGeometryPools(); // delete every buffer and vertex array
@@ -0,0 +1,456 @@
+#include "glstate.h"
+
+#include <unordered_map>
+
+// Value used for state we don't know, never a valid object name
+static const GLuint UNKNOWN = 0xFFFFFFFF;
+
+// Texture units and targets tracked per unit, other targets are passed straight through
+static const unsigned int MAX_TEXTURE_UNITS = 32;
+static const GLenum TEXTURE_TARGETS[] = { GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BUFFER };
+static const unsigned int TEXTURE_TARGET_COUNT = sizeof(TEXTURE_TARGETS) / sizeof(TEXTURE_TARGETS[0]);
+
+// Struct to hold an indexed buffer binding. Whole buffer bindings have an offset and size of 0.
+struct IndexedBinding
+{
+	GLuint buffer;
+	GLintptr offset;
+	GLsizeiptr size;
+};
+
+// Shadow state
+static GLuint currentProgram = UNKNOWN;
+static GLuint currentVertexArray = UNKNOWN;
+static GLenum currentTextureUnit = UNKNOWN;
+static GLuint currentTextures[MAX_TEXTURE_UNITS][TEXTURE_TARGET_COUNT];
+static std::unordered_map<GLenum, GLuint> currentBuffers;
+static std::unordered_map<unsigned long long, IndexedBinding> currentBufferBases;
+static std::unordered_map<GLenum, bool> currentCapabilities;
+static GLuint currentDepthFunc = UNKNOWN;
+static GLuint currentDepthMask = UNKNOWN;
+static GLuint currentColorMask = UNKNOWN; // one bit per channel, red lowest
+static GLuint currentCullFace = UNKNOWN;
+static GLuint currentFrontFace = UNKNOWN;
+
+// Call counts
+static GLStateStats frameStats;
+static GLStateStats lastFrameStats;
+
+// Count a call, returning true if it should go to GL
+static bool Changed(GLuint& current, GLuint value)
+{
+	if (current == value)
+	{
+		frameStats.suppressed++;
+		return false;
+	}
+
+	current = value;
+	frameStats.issued++;
+	return true;
+}
+
+// Triangles drawn by a number of indices
+static unsigned long long TriangleCount(GLenum mode, unsigned long long indexCount)
+{
+	return mode == GL_TRIANGLES ? indexCount / 3 : 0;
+}
+
+// Bytes glTexImage2D reads per pixel, for the common formats and types
+static unsigned int PixelSize(GLenum format, GLenum type)
+{
+	unsigned int components;
+
+	switch (format)
+	{
+	case GL_RED:
+	case GL_DEPTH_COMPONENT:
+		components = 1;
+		break;
+	case GL_RG:
+		components = 2;
+		break;
+	case GL_RGB:
+	case GL_BGR:
+		components = 3;
+		break;
+	default:
+		components = 4;
+		break;
+	}
+
+	switch (type)
+	{
+	case GL_UNSIGNED_BYTE:
+	case GL_BYTE:
+		return components;
+	case GL_UNSIGNED_SHORT:
+	case GL_SHORT:
+	case GL_HALF_FLOAT:
+		return components * 2;
+	case GL_UNSIGNED_INT:
+	case GL_INT:
+	case GL_FLOAT:
+		return components * 4;
+	default:
+		return 4; // packed types, a whole pixel in one 32 bit value at most
+	}
+}
+
+static int TextureTargetIndex(GLenum target)
+{
+	for (unsigned int i = 0; i < TEXTURE_TARGET_COUNT; i++)
+	{
+		if (TEXTURE_TARGETS[i] == target)
+			return i;
+	}
+
+	return -1;
+}
+
+void ResetGLState()
+{
+	currentProgram = UNKNOWN;
+	currentVertexArray = UNKNOWN;
+	currentTextureUnit = UNKNOWN;
+
+	for (unsigned int i = 0; i < MAX_TEXTURE_UNITS; i++)
+	{
+		for (unsigned int j = 0; j < TEXTURE_TARGET_COUNT; j++)
+			currentTextures[i][j] = UNKNOWN;
+	}
+
+	currentBuffers.clear();
+	currentBufferBases.clear();
+	currentCapabilities.clear();
+	currentDepthFunc = UNKNOWN;
+	currentDepthMask = UNKNOWN;
+	currentColorMask = UNKNOWN;
+	currentCullFace = UNKNOWN;
+	currentFrontFace = UNKNOWN;
+}
+
+void ResetGLStateStats()
+{
+	lastFrameStats = frameStats;
+	frameStats = GLStateStats();
+}
+
+const GLStateStats& GetGLStateStats()
+{
+	return lastFrameStats;
+}
+
+void StateUseProgram(GLuint program)
+{
+	if (Changed(currentProgram, program))
+	{
+		frameStats.programBinds++;
+		glUseProgram(program);
+	}
+}
+
+void StateBindVertexArray(GLuint vertexArray)
+{
+	if (Changed(currentVertexArray, vertexArray))
+	{
+		frameStats.vertexArrayBinds++;
+		glBindVertexArray(vertexArray);
+
+		// The element array binding comes with the vertex array
+		currentBuffers.erase(GL_ELEMENT_ARRAY_BUFFER);
+	}
+}
+
+void StateActiveTexture(GLenum unit)
+{
+	if (Changed(currentTextureUnit, unit))
+		glActiveTexture(unit);
+}
+
+void StateBindTexture(GLenum target, GLuint texture)
+{
+	int targetIndex = TextureTargetIndex(target);
+	unsigned int unit = currentTextureUnit - GL_TEXTURE0;
+
+	// Don't know which unit is active, or a target we don't track
+	if (targetIndex < 0 || currentTextureUnit == UNKNOWN || unit >= MAX_TEXTURE_UNITS)
+	{
+		frameStats.issued++;
+		frameStats.textureBinds++;
+		glBindTexture(target, texture);
+		return;
+	}
+
+	if (Changed(currentTextures[unit][targetIndex], texture))
+	{
+		frameStats.textureBinds++;
+		glBindTexture(target, texture);
+	}
+}
+
+void StateBindTextureUnit(GLuint unit, GLenum target, GLuint texture)
+{
+	int targetIndex = TextureTargetIndex(target);
+
+	// Skip the unit switch entirely if the texture is already there
+	if (targetIndex >= 0 && unit < MAX_TEXTURE_UNITS && currentTextures[unit][targetIndex] == texture)
+	{
+		frameStats.suppressed++;
+		return;
+	}
+
+	StateActiveTexture(GL_TEXTURE0 + unit);
+	StateBindTexture(target, texture);
+}
+
+void StateBindBuffer(GLenum target, GLuint buffer)
+{
+	// Insert as unknown the first time a target is seen
+	GLuint& current = currentBuffers.insert(std::make_pair(target, UNKNOWN)).first->second;
+
+	if (Changed(current, buffer))
+		glBindBuffer(target, buffer);
+}
+
+// Set an indexed binding, unless it is already set
+static bool SetIndexedBinding(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+	unsigned long long key = ((unsigned long long)target << 32) | index;
+	IndexedBinding unknown = { UNKNOWN, 0, 0 };
+	IndexedBinding& current = currentBufferBases.insert(std::make_pair(key, unknown)).first->second;
+
+	if (current.buffer == buffer && current.offset == offset && current.size == size)
+	{
+		frameStats.suppressed++;
+		return false;
+	}
+
+	current.buffer = buffer;
+	current.offset = offset;
+	current.size = size;
+	frameStats.issued++;
+
+	// Binding to an indexed point binds the generic target as well
+	currentBuffers[target] = buffer;
+
+	return true;
+}
+
+void StateBindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+	if (SetIndexedBinding(target, index, buffer, 0, 0))
+		glBindBufferBase(target, index, buffer);
+}
+
+void StateBindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+	if (SetIndexedBinding(target, index, buffer, offset, size))
+		glBindBufferRange(target, index, buffer, offset, size);
+}
+
+// Set a capability, unless it is already set
+static void SetCapability(GLenum capability, bool enabled)
+{
+	auto current = currentCapabilities.find(capability);
+
+	if (current != currentCapabilities.end() && current->second == enabled)
+	{
+		frameStats.suppressed++;
+		return;
+	}
+
+	currentCapabilities[capability] = enabled;
+	frameStats.issued++;
+
+	if (enabled)
+		glEnable(capability);
+	else
+		glDisable(capability);
+}
+
+void StateEnable(GLenum capability)
+{
+	SetCapability(capability, true);
+}
+
+void StateDisable(GLenum capability)
+{
+	SetCapability(capability, false);
+}
+
+void StateDepthFunc(GLenum func)
+{
+	if (Changed(currentDepthFunc, func))
+		glDepthFunc(func);
+}
+
+void StateDepthMask(GLboolean enabled)
+{
+	if (Changed(currentDepthMask, enabled ? 1 : 0))
+		glDepthMask(enabled);
+}
+
+void StateColorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha)
+{
+	GLuint mask = (red ? 1 : 0) | (green ? 2 : 0) | (blue ? 4 : 0) | (alpha ? 8 : 0);
+
+	if (Changed(currentColorMask, mask))
+		glColorMask(red, green, blue, alpha);
+}
+
+void StateCullFace(GLenum face)
+{
+	if (Changed(currentCullFace, face))
+		glCullFace(face);
+}
+
+void StateFrontFace(GLenum mode)
+{
+	if (Changed(currentFrontFace, mode))
+		glFrontFace(mode);
+}
+
+void StateDrawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, const void* indices, GLint baseVertex)
+{
+	frameStats.drawCalls++;
+	frameStats.drawCommands++;
+	frameStats.triangles += TriangleCount(mode, count);
+
+	glDrawElementsBaseVertex(mode, count, type, indices, baseVertex);
+}
+
+void StateDrawElementsInstancedBaseVertex(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instanceCount, GLint baseVertex)
+{
+	frameStats.drawCalls++;
+	frameStats.drawCommands++;
+	frameStats.triangles += TriangleCount(mode, (unsigned long long)count * instanceCount);
+
+	glDrawElementsInstancedBaseVertex(mode, count, type, indices, instanceCount, baseVertex);
+}
+
+void StateMultiDrawElementsIndirect(GLenum mode, GLenum type, const void* indirect, GLsizei drawCount, GLsizei stride, unsigned long long indexCount)
+{
+	frameStats.drawCalls++;
+	frameStats.drawCommands += drawCount;
+	frameStats.triangles += TriangleCount(mode, indexCount);
+
+	glMultiDrawElementsIndirect(mode, type, indirect, drawCount, stride);
+}
+
+void StateUniform1i(GLint location, GLint value)
+{
+	if (location == -1)
+		return;
+
+	frameStats.uniformUploads++;
+	glUniform1i(location, value);
+}
+
+void StateUniform3fv(GLint location, GLsizei count, const GLfloat* value)
+{
+	if (location == -1)
+		return;
+
+	frameStats.uniformUploads++;
+	glUniform3fv(location, count, value);
+}
+
+void StateUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value)
+{
+	if (location == -1)
+		return;
+
+	frameStats.uniformUploads++;
+	glUniformMatrix4fv(location, count, transpose, value);
+}
+
+void StateBufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage)
+{
+	if (data != nullptr)
+		frameStats.bufferBytes += size;
+
+	glBufferData(target, size, data, usage);
+}
+
+void StateBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data)
+{
+	frameStats.bufferBytes += size;
+	glBufferSubData(target, offset, size, data);
+}
+
+void StateTexImage2D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void* pixels)
+{
+	if (pixels != nullptr)
+		frameStats.textureBytes += (unsigned long long)width * height * PixelSize(format, type);
+
+	glTexImage2D(target, level, internalFormat, width, height, border, format, type, pixels);
+}
+
+void CountBufferUpload(GLsizeiptr size)
+{
+	frameStats.bufferBytes += size;
+}
+
+void StateDeleteProgram(GLuint program)
+{
+	// Deleting the current program doesn't unbind it in GL, but it does leave it flagged for deletion. Forget it so the next use rebinds.
+	if (currentProgram == program)
+		currentProgram = UNKNOWN;
+
+	glDeleteProgram(program);
+}
+
+void StateDeleteVertexArrays(GLsizei count, const GLuint* vertexArrays)
+{
+	for (GLsizei i = 0; i < count; i++)
+	{
+		// Deleting the bound vertex array reverts to 0
+		if (currentVertexArray == vertexArrays[i])
+		{
+			currentVertexArray = 0;
+			currentBuffers.erase(GL_ELEMENT_ARRAY_BUFFER);
+		}
+	}
+
+	glDeleteVertexArrays(count, vertexArrays);
+}
+
+void StateDeleteTextures(GLsizei count, const GLuint* textures)
+{
+	for (GLsizei i = 0; i < count; i++)
+	{
+		// Deleting a bound texture reverts its units to 0
+		for (unsigned int unit = 0; unit < MAX_TEXTURE_UNITS; unit++)
+		{
+			for (unsigned int target = 0; target < TEXTURE_TARGET_COUNT; target++)
+			{
+				if (currentTextures[unit][target] == textures[i])
+					currentTextures[unit][target] = 0;
+			}
+		}
+	}
+
+	glDeleteTextures(count, textures);
+}
+
+void StateDeleteBuffers(GLsizei count, const GLuint* buffers)
+{
+	for (GLsizei i = 0; i < count; i++)
+	{
+		// Deleting a bound buffer reverts its bindings to 0
+		for (auto& binding : currentBuffers)
+		{
+			if (binding.second == buffers[i])
+				binding.second = 0;
+		}
+
+		for (auto& binding : currentBufferBases)
+		{
+			if (binding.second.buffer == buffers[i])
+				binding.second = IndexedBinding { 0, 0, 0 };
+		}
+	}
+
+	glDeleteBuffers(count, buffers);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <GL/glew.h>
+
+// Thin state tracking layer over the GL binding calls. Each function shadows the state it changes and
+// only calls into GL when the value actually differs, so callers can set the state they need without
+// checking what is already bound. All binding, capability, fixed function and delete calls must go through here,
+// otherwise the shadow copy goes stale (call ResetGLState() after anything that bypasses it).
+// Draw, uniform and upload calls also go through here, so the work submitted each frame can be counted.
+
+// Struct to hold per frame call counts
+struct GLStateStats
+{
+	unsigned int issued = 0; // calls passed on to GL
+	unsigned int suppressed = 0; // calls dropped because the state was already set
+
+	// Work submitted
+	unsigned int drawCalls = 0; // GL draw calls, a multi-draw counts once
+	unsigned int drawCommands = 0; // draws including each command of a multi-draw
+	unsigned long long triangles = 0; // including every instance
+	unsigned int programBinds = 0; // binds that went to GL
+	unsigned int vertexArrayBinds = 0;
+	unsigned int textureBinds = 0;
+	unsigned int uniformUploads = 0;
+	unsigned long long bufferBytes = 0; // uploaded with glBufferData, glBufferSubData or written through a mapping
+	unsigned long long textureBytes = 0; // uploaded with glTexImage2D
+};
+
+void ResetGLState(); // forget everything, the next call of each kind always goes to GL
+void ResetGLStateStats(); // start counting a new frame, keeping the last frame's counts
+const GLStateStats& GetGLStateStats(); // counts for the last complete frame
+
+// Programs and vertex arrays
+void StateUseProgram(GLuint program);
+void StateBindVertexArray(GLuint vertexArray);
+
+// Textures, tracked per unit
+void StateActiveTexture(GLenum unit);
+void StateBindTexture(GLenum target, GLuint texture); // bind to the active unit
+void StateBindTextureUnit(GLuint unit, GLenum target, GLuint texture); // make unit active if needed, then bind
+
+// Buffers. GL_ELEMENT_ARRAY_BUFFER is part of the vertex array object, so it is forgotten whenever the vertex array changes.
+void StateBindBuffer(GLenum target, GLuint buffer);
+void StateBindBufferBase(GLenum target, GLuint index, GLuint buffer);
+void StateBindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
+// Capabilities
+void StateEnable(GLenum capability);
+void StateDisable(GLenum capability);
+
+// Fixed function state
+void StateDepthFunc(GLenum func);
+void StateDepthMask(GLboolean enabled);
+void StateColorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha);
+void StateCullFace(GLenum face);
+void StateFrontFace(GLenum mode);
+
+// Draws, counting calls and triangles (GL_TRIANGLES only)
+void StateDrawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, const void* indices, GLint baseVertex);
+void StateDrawElementsInstancedBaseVertex(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instanceCount, GLint baseVertex);
+void StateMultiDrawElementsIndirect(GLenum mode, GLenum type, const void* indirect, GLsizei drawCount, GLsizei stride, unsigned long long indexCount); // GL reads the commands from a buffer, so the caller passes their total index count, instances included
+
+// Uniform uploads to the current program. Locations of -1 are ignored by GL and not counted.
+void StateUniform1i(GLint location, GLint value);
+void StateUniform3fv(GLint location, GLsizei count, const GLfloat* value);
+void StateUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value);
+
+// Uploads, counting the bytes sent
+void StateBufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage); // only counted if there is data
+void StateBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data);
+void StateTexImage2D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void* pixels);
+void CountBufferUpload(GLsizeiptr size); // bytes written through a mapped buffer, which GL never sees
+
+// Deleting objects also clears them from the shadow state, as GL unbinds them
+void StateDeleteProgram(GLuint program);
+void StateDeleteVertexArrays(GLsizei count, const GLuint* vertexArrays);
+void StateDeleteTextures(GLsizei count, const GLuint* textures);
+void StateDeleteBuffers(GLsizei count, const GLuint* buffers);
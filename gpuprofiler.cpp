@@ -0,0 +1,237 @@
+#include "gpuprofiler.h"
+
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include <SDL/SDL.h>
+
+// Struct to hold the averaged timings of one pass
+struct PassTiming
+{
+	std::string name;
+	unsigned int depth = 0; // nesting level, for indenting
+	double cpuMilliseconds = 0.0; // time to submit, averaged over frames
+	double gpuMilliseconds = 0.0; // time the GPU spent, averaged over frames
+	unsigned int frames = 0;
+};
+
+// Struct to hold one pass recorded in a frame
+struct RecordedPass
+{
+	unsigned int timing; // index into passTimings
+	unsigned int beginQuery, endQuery; // indices into the frame's queries
+	Uint64 cpuBegin, cpuEnd;
+};
+
+// Struct to hold one frame of queries
+struct ProfilerFrame
+{
+	std::vector<GLuint> queries; // grows as needed, never shrinks
+	unsigned int usedQueries = 0;
+	std::vector<RecordedPass> passes;
+	bool pending = false; // recorded, results not collected yet
+};
+
+static ProfilerFrame profilerFrames[GPU_PROFILER_FRAMES];
+static unsigned int currentFrame = 0;
+static std::vector<unsigned int> openPasses; // stack of indices into the current frame's passes
+
+// Accumulated results
+static std::vector<PassTiming> passTimings; // averages since the last reset, in the order passes were first seen
+static std::vector<double> cpuTotals;
+static std::vector<double> gpuTotals;
+static unsigned int droppedFrames = 0; // frames whose results weren't ready in time
+
+// The frame collected by the last BeginProfilerFrame
+static bool frameCollected = false;
+static double collectedFrameMilliseconds = 0.0;
+
+// Issue a timestamp query from the frame's pool, returning its index
+static unsigned int Timestamp(ProfilerFrame& frame)
+{
+	if (frame.usedQueries == frame.queries.size())
+	{
+		GLuint query;
+		glGenQueries(1, &query);
+		frame.queries.push_back(query);
+	}
+
+	glQueryCounter(frame.queries[frame.usedQueries], GL_TIMESTAMP);
+
+	return frame.usedQueries++;
+}
+
+// Find or add the accumulated timing for a pass name
+static unsigned int FindTiming(const std::string& name, unsigned int depth)
+{
+	for (unsigned int i = 0; i < passTimings.size(); i++)
+	{
+		if (passTimings[i].name == name)
+			return i;
+	}
+
+	PassTiming timing;
+	timing.name = name;
+	timing.depth = depth;
+	passTimings.push_back(timing);
+	cpuTotals.push_back(0.0);
+	gpuTotals.push_back(0.0);
+
+	return passTimings.size() - 1;
+}
+
+// Read a frame's results if they are all there. The last query issued finishes last, so checking it is enough.
+static void CollectFrame(ProfilerFrame& frame)
+{
+	if (!frame.pending)
+		return;
+
+	frame.pending = false;
+
+	if (frame.usedQueries == 0)
+		return;
+
+	GLint available = GL_FALSE;
+	glGetQueryObjectiv(frame.queries[frame.usedQueries - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+
+	if (!available)
+	{
+		droppedFrames++;
+		return;
+	}
+
+	double counterToMilliseconds = 1000.0 / SDL_GetPerformanceFrequency();
+
+	// The whole frame, from its first timestamp to its last
+	GLuint64 frameBegin = 0, frameEnd = 0;
+	glGetQueryObjectui64v(frame.queries[0], GL_QUERY_RESULT, &frameBegin);
+	glGetQueryObjectui64v(frame.queries[frame.usedQueries - 1], GL_QUERY_RESULT, &frameEnd);
+	collectedFrameMilliseconds = (frameEnd - frameBegin) / 1000000.0;
+	frameCollected = true;
+
+	for (const RecordedPass& pass : frame.passes)
+	{
+		GLuint64 begin = 0, end = 0;
+		glGetQueryObjectui64v(frame.queries[pass.beginQuery], GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(frame.queries[pass.endQuery], GL_QUERY_RESULT, &end);
+
+		PassTiming& timing = passTimings[pass.timing];
+		gpuTotals[pass.timing] += (end - begin) / 1000000.0;
+		cpuTotals[pass.timing] += (pass.cpuEnd - pass.cpuBegin) * counterToMilliseconds;
+		timing.frames++;
+		timing.cpuMilliseconds = cpuTotals[pass.timing] / timing.frames;
+		timing.gpuMilliseconds = gpuTotals[pass.timing] / timing.frames;
+	}
+}
+
+void InitialiseGPUProfiler()
+{
+	currentFrame = 0;
+	droppedFrames = 0;
+}
+
+void ShutdownGPUProfiler()
+{
+	for (ProfilerFrame& frame : profilerFrames)
+	{
+		if (!frame.queries.empty())
+			glDeleteQueries(frame.queries.size(), frame.queries.data());
+
+		frame = ProfilerFrame();
+	}
+
+	openPasses.clear();
+}
+
+void BeginProfilerFrame()
+{
+	// The slot we are about to reuse holds the oldest frame
+	currentFrame = (currentFrame + 1) % GPU_PROFILER_FRAMES;
+	ProfilerFrame& frame = profilerFrames[currentFrame];
+	frameCollected = false;
+	CollectFrame(frame);
+
+	frame.usedQueries = 0;
+	frame.passes.clear();
+	openPasses.clear();
+}
+
+void EndProfilerFrame()
+{
+	// Close anything left open, so the frame's results are complete
+	while (!openPasses.empty())
+		EndPass();
+
+	profilerFrames[currentFrame].pending = true;
+}
+
+void BeginPass(const std::string& name)
+{
+	ProfilerFrame& frame = profilerFrames[currentFrame];
+
+	RecordedPass pass;
+	pass.timing = FindTiming(name, openPasses.size());
+	pass.cpuBegin = SDL_GetPerformanceCounter();
+	pass.beginQuery = Timestamp(frame);
+	pass.endQuery = pass.beginQuery;
+	pass.cpuEnd = pass.cpuBegin;
+
+	openPasses.push_back(frame.passes.size());
+	frame.passes.push_back(pass);
+}
+
+void EndPass()
+{
+	if (openPasses.empty())
+		return;
+
+	ProfilerFrame& frame = profilerFrames[currentFrame];
+	RecordedPass& pass = frame.passes[openPasses.back()];
+	openPasses.pop_back();
+
+	pass.endQuery = Timestamp(frame);
+	pass.cpuEnd = SDL_GetPerformanceCounter();
+}
+
+bool GetCollectedFrameTime(double& gpuMilliseconds)
+{
+	gpuMilliseconds = collectedFrameMilliseconds;
+	return frameCollected;
+}
+
+void ResetPassTimings()
+{
+	// Zero the averages but keep the entries, frames in flight refer to them and are still collected
+	for (unsigned int i = 0; i < passTimings.size(); i++)
+	{
+		passTimings[i].cpuMilliseconds = 0.0;
+		passTimings[i].gpuMilliseconds = 0.0;
+		passTimings[i].frames = 0;
+		cpuTotals[i] = 0.0;
+		gpuTotals[i] = 0.0;
+	}
+
+	droppedFrames = 0;
+}
+
+void PrintPassTimings()
+{
+	std::cout << std::left << std::setw(32) << "Pass" << std::right << std::setw(10) << "CPU ms" << std::setw(10) << "GPU ms" << std::setw(8) << "Frames" << std::endl;
+
+	for (const PassTiming& timing : passTimings)
+	{
+		// Passes not seen since the last reset, such as bucket passes that were turned off
+		if (timing.frames == 0)
+			continue;
+
+		std::cout << std::left << std::setw(32) << (std::string(timing.depth * 2, ' ') + timing.name) << std::right << std::fixed << std::setprecision(3)
+			<< std::setw(10) << timing.cpuMilliseconds << std::setw(10) << timing.gpuMilliseconds << std::setw(8) << timing.frames << std::endl;
+	}
+
+	std::cout.unsetf(std::ios::floatfield);
+	std::cout << std::setprecision(6);
+
+	if (droppedFrames > 0)
+		std::cout << droppedFrames << " profiler frames dropped, results weren't ready in time" << std::endl;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+
+#include <GL/glew.h>
+
+// Frames of queries kept in flight. Results are read this many frames after they were issued, by which
+// time the GPU has normally finished them, so reading never stalls.
+const unsigned int GPU_PROFILER_FRAMES = 4;
+
+// GPU profiler. Passes are bracketed by glQueryCounter(GL_TIMESTAMP) queries, so they can nest, and
+// timed on the CPU at the same points. Each frame uses its own set of queries from a ring, and results
+// are collected GPU_PROFILER_FRAMES frames later. If a frame still isn't done by then its results are
+// dropped rather than waited for. All calls must come from the thread that owns the GL context.
+void InitialiseGPUProfiler();
+void ShutdownGPUProfiler();
+
+void BeginProfilerFrame(); // collect the oldest frame's results and start recording a new frame
+void EndProfilerFrame();
+void BeginPass(const std::string& name);
+void EndPass();
+
+bool GetCollectedFrameTime(double& gpuMilliseconds); // GPU time from the first to the last query of the frame collected by the last BeginProfilerFrame. False if none was.
+void ResetPassTimings(); // zero the per pass averages, frames still in flight are collected into the new ones
+void PrintPassTimings(); // table of CPU and GPU milliseconds per pass
@@ -0,0 +1,232 @@
+#include "headless.h"
+
+#include <cstring>
+#include <iostream>
+
+#ifdef __linux__
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+// Framebuffer drawn into instead of the window
+static GLuint headlessFramebuffer = 0;
+static GLuint headlessColorBuffer = 0;
+static GLuint headlessDepthBuffer = 0;
+
+#ifdef __linux__
+
+static EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+static EGLContext eglContext = EGL_NO_CONTEXT;
+static EGLSurface eglSurface = EGL_NO_SURFACE; // only used if surfaceless contexts aren't supported
+
+// Check a space separated extension string for a name
+static bool HasExtension(const char* extensions, const char* name)
+{
+	if (extensions == nullptr)
+		return false;
+
+	size_t length = strlen(name);
+
+	for (const char* found = strstr(extensions, name); found != nullptr; found = strstr(found + length, name))
+	{
+		if ((found == extensions || found[-1] == ' ') && (found[length] == ' ' || found[length] == '\0'))
+			return true;
+	}
+
+	return false;
+}
+
+bool CreateHeadlessContext(unsigned int majorVersion, unsigned int minorVersion)
+{
+	// Prefer the surfaceless platform, it needs no display server or device. Fall back to the default display.
+	const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+
+	if (HasExtension(clientExtensions, "EGL_MESA_platform_surfaceless") && HasExtension(clientExtensions, "EGL_EXT_platform_base"))
+	{
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+		if (getPlatformDisplay != nullptr)
+			eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+	}
+
+	if (eglDisplay == EGL_NO_DISPLAY)
+		eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	EGLint eglMajor, eglMinor;
+
+	if (eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, &eglMajor, &eglMinor))
+	{
+		std::cout << "Error initialising EGL: " << std::hex << eglGetError() << std::dec << std::endl;
+		eglDisplay = EGL_NO_DISPLAY;
+		return false;
+	}
+
+	// Desktop GL rather than GLES
+	if (!eglBindAPI(EGL_OPENGL_API))
+	{
+		std::cout << "EGL has no desktop OpenGL" << std::endl;
+		DestroyHeadlessContext();
+		return false;
+	}
+
+	// Without surfaceless contexts, make current with a tiny pbuffer. It is never drawn to.
+	const char* displayExtensions = eglQueryString(eglDisplay, EGL_EXTENSIONS);
+	bool surfaceless = HasExtension(displayExtensions, "EGL_KHR_surfaceless_context");
+	bool createContext = HasExtension(displayExtensions, "EGL_KHR_create_context") || eglMajor > 1 || (eglMajor == 1 && eglMinor >= 5);
+
+	EGLint configAttributes[] =
+	{
+		EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+
+	EGLConfig config;
+	EGLint configCount = 0;
+
+	if (!eglChooseConfig(eglDisplay, configAttributes, &config, 1, &configCount) || configCount == 0)
+	{
+		std::cout << "No EGL config for desktop OpenGL" << std::endl;
+		DestroyHeadlessContext();
+		return false;
+	}
+
+	// Ask for the version and core profile if we can, otherwise take what we get
+	EGLint contextAttributes[] =
+	{
+		EGL_CONTEXT_MAJOR_VERSION_KHR, (EGLint)majorVersion,
+		EGL_CONTEXT_MINOR_VERSION_KHR, (EGLint)minorVersion,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+		EGL_NONE
+	};
+
+	eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, createContext ? contextAttributes : nullptr);
+
+	if (eglContext == EGL_NO_CONTEXT)
+	{
+		std::cout << "Error creating EGL context: " << std::hex << eglGetError() << std::dec << std::endl;
+		DestroyHeadlessContext();
+		return false;
+	}
+
+	if (!surfaceless)
+	{
+		EGLint surfaceAttributes[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+		eglSurface = eglCreatePbufferSurface(eglDisplay, config, surfaceAttributes);
+
+		if (eglSurface == EGL_NO_SURFACE)
+		{
+			std::cout << "Error creating EGL pbuffer: " << std::hex << eglGetError() << std::dec << std::endl;
+			DestroyHeadlessContext();
+			return false;
+		}
+	}
+
+	if (!MakeHeadlessContextCurrent(true))
+	{
+		std::cout << "Error making EGL context current: " << std::hex << eglGetError() << std::dec << std::endl;
+		DestroyHeadlessContext();
+		return false;
+	}
+
+	std::cout << "EGL " << eglMajor << "." << eglMinor << " " << (surfaceless ? "surfaceless" : "pbuffer") << " context" << std::endl;
+
+	return true;
+}
+
+void DestroyHeadlessContext()
+{
+	if (eglDisplay == EGL_NO_DISPLAY)
+		return;
+
+	eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+
+	if (eglSurface != EGL_NO_SURFACE)
+		eglDestroySurface(eglDisplay, eglSurface);
+
+	if (eglContext != EGL_NO_CONTEXT)
+		eglDestroyContext(eglDisplay, eglContext);
+
+	eglTerminate(eglDisplay);
+
+	eglDisplay = EGL_NO_DISPLAY;
+	eglContext = EGL_NO_CONTEXT;
+	eglSurface = EGL_NO_SURFACE;
+}
+
+bool MakeHeadlessContextCurrent(bool current)
+{
+	if (current)
+		return eglMakeCurrent(eglDisplay, eglSurface, eglSurface, eglContext) == EGL_TRUE;
+
+	return eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT) == EGL_TRUE;
+}
+
+#else
+
+bool CreateHeadlessContext(unsigned int, unsigned int)
+{
+	std::cout << "Headless rendering is only supported on Linux" << std::endl;
+	return false;
+}
+
+void DestroyHeadlessContext()
+{
+}
+
+bool MakeHeadlessContextCurrent(bool)
+{
+	return false;
+}
+
+#endif
+
+bool CreateHeadlessFramebuffer(unsigned int width, unsigned int height)
+{
+	// sRGB color, to match the window's framebuffer
+	glGenRenderbuffers(1, &headlessColorBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, headlessColorBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_SRGB8_ALPHA8, width, height);
+
+	glGenRenderbuffers(1, &headlessDepthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, headlessDepthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &headlessFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, headlessFramebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, headlessColorBuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, headlessDepthBuffer);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cout << "Headless framebuffer incomplete: " << std::hex << status << std::dec << std::endl;
+		DestroyHeadlessFramebuffer();
+		return false;
+	}
+
+	glViewport(0, 0, width, height);
+
+	return true;
+}
+
+void DestroyHeadlessFramebuffer()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (headlessFramebuffer != 0)
+		glDeleteFramebuffers(1, &headlessFramebuffer);
+
+	if (headlessColorBuffer != 0)
+		glDeleteRenderbuffers(1, &headlessColorBuffer);
+
+	if (headlessDepthBuffer != 0)
+		glDeleteRenderbuffers(1, &headlessDepthBuffer);
+
+	headlessFramebuffer = 0;
+	headlessColorBuffer = 0;
+	headlessDepthBuffer = 0;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <GL/glew.h>
+
+// Returned by glewInit from GLEW 2.0 when there is no GLX display, as with an EGL context. Every GL
+// function has been loaded by then, so headless it isn't an error. Newer than our copy of glew.
+#ifndef GLEW_ERROR_NO_GLX_DISPLAY
+#define GLEW_ERROR_NO_GLX_DISPLAY 4
+#endif
+
+// Headless rendering, for benchmarking without a window or display server. The context comes from EGL,
+// with Mesa's surfaceless platform where there is one (llvmpipe works anywhere), and frames are drawn
+// into a framebuffer object instead of a window. Linux only, elsewhere creating the context fails.
+bool CreateHeadlessContext(unsigned int majorVersion, unsigned int minorVersion); // core profile. False, with a message, if it couldn't be created.
+void DestroyHeadlessContext();
+bool MakeHeadlessContextCurrent(bool current); // make current on the calling thread, or release it
+
+// Color and depth renderbuffers at a fixed size, in place of the window's framebuffer. Create once the
+// context is current and GLEW is initialised. Leaves the framebuffer bound and the viewport covering it.
+bool CreateHeadlessFramebuffer(unsigned int width, unsigned int height);
+void DestroyHeadlessFramebuffer();
@@ -0,0 +1,103 @@
+#include "indirect.h"
+#include "glstate.h"
+#include "ringbuffer.h"
+
+#include <cstring>
+#include <vector>
+
+// Commands and per draw data for this frame
+static std::vector<DrawElementsIndirectCommand> indirectCommands;
+static std::vector<InstanceData> indirectData;
+
+// Where this frame's commands were written in the ring buffer
+static GLintptr indirectCommandOffset = 0;
+static GLuint indirectVertexArrays[VERTEX_FORMAT_COUNT] = { 0 };
+
+bool IndirectDrawSupported()
+{
+	return (GLEW_VERSION_4_3 || GLEW_ARB_multi_draw_indirect) && (GLEW_VERSION_4_2 || GLEW_ARB_base_instance);
+}
+
+void CreateIndirectVertexArrays()
+{
+	// Per draw data is read as instance attributes from the ring buffer, through baseInstance
+	for (unsigned int i = 0; i < VERTEX_FORMAT_COUNT; i++)
+		indirectVertexArrays[i] = CreateInstancedVertexArray((VertexFormat)i, GetRingBuffer());
+}
+
+void DestroyIndirectVertexArrays()
+{
+	for (unsigned int i = 0; i < VERTEX_FORMAT_COUNT; i++)
+	{
+		if (indirectVertexArrays[i] != 0)
+			DeleteInstancedVertexArray(indirectVertexArrays[i]);
+
+		indirectVertexArrays[i] = 0;
+	}
+}
+
+void BeginIndirectDraws()
+{
+	indirectCommands.clear();
+	indirectData.clear();
+}
+
+unsigned int AddIndirectDraw(const GeometryAllocation& geometry, const InstanceData& data)
+{
+	unsigned int index = indirectCommands.size();
+
+	DrawElementsIndirectCommand command;
+	command.count = geometry.indexCount;
+	command.instanceCount = 1;
+	command.firstIndex = geometry.firstIndex;
+	command.baseVertex = geometry.baseVertex;
+	command.baseInstance = index; // the instance attributes start at this draw's data, offset to the frame's data when uploaded
+
+	indirectCommands.push_back(command);
+	indirectData.push_back(data);
+
+	return index;
+}
+
+bool UploadIndirectDraws()
+{
+	if (indirectCommands.empty())
+		return true;
+
+	// Commands must be 4 byte aligned, per draw data is aligned to its own size so its offset is a whole number of instances
+	RingAllocation commands = AllocateRing(indirectCommands.size() * sizeof(DrawElementsIndirectCommand), sizeof(GLuint));
+	RingAllocation data = AllocateRing(indirectData.size() * sizeof(InstanceData), sizeof(InstanceData));
+
+	if (commands.data == nullptr || data.data == nullptr)
+		return false;
+
+	// Point every command at the frame's data
+	GLuint firstInstance = data.offset / sizeof(InstanceData);
+	DrawElementsIndirectCommand* command = (DrawElementsIndirectCommand*)commands.data;
+
+	for (const DrawElementsIndirectCommand& source : indirectCommands)
+	{
+		*command = source;
+		command->baseInstance += firstInstance;
+		command++;
+	}
+
+	memcpy(data.data, indirectData.data(), data.size);
+	indirectCommandOffset = commands.offset;
+
+	return true;
+}
+
+void SubmitIndirectDraws(VertexFormat format, unsigned int firstCommand, unsigned int commandCount)
+{
+	StateBindVertexArray(indirectVertexArrays[format]);
+	StateBindBuffer(GL_DRAW_INDIRECT_BUFFER, GetRingBuffer());
+
+	// Indices drawn, for the triangle count, from our copy of the commands
+	unsigned long long indexCount = 0;
+
+	for (unsigned int i = firstCommand; i < firstCommand + commandCount; i++)
+		indexCount += (unsigned long long)indirectCommands[i].count * indirectCommands[i].instanceCount;
+
+	StateMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(indirectCommandOffset + firstCommand * sizeof(DrawElementsIndirectCommand)), commandCount, 0, indexCount);
+}
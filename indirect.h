@@ -0,0 +1,29 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include "geometry.h"
+
+// Struct matching the layout glMultiDrawElementsIndirect reads from GL_DRAW_INDIRECT_BUFFER
+struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+// Multi-draw indirect submission. Each frame, draws are added as commands with their per draw data
+// (matrix and color), written to the ring buffer together, then submitted in ranges that share program
+// and texture state.
+// Each command draws one instance with baseInstance set to its own index, so the per draw attributes
+// fetch that draw's data. Needs GL_ARB_multi_draw_indirect and GL_ARB_base_instance (GL 4.3).
+bool IndirectDrawSupported();
+void CreateIndirectVertexArrays(); // call after the geometry and ring buffer have been created
+void DestroyIndirectVertexArrays();
+
+void BeginIndirectDraws(); // clear last frame's commands
+unsigned int AddIndirectDraw(const GeometryAllocation& geometry, const InstanceData& data); // returns the command index
+bool UploadIndirectDraws(); // write every command and its data to the ring buffer, once per frame. False if it didn't fit.
+void SubmitIndirectDraws(VertexFormat format, unsigned int firstCommand, unsigned int commandCount); // one glMultiDrawElementsIndirect for a range of commands
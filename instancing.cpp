@@ -0,0 +1,98 @@
+#include "instancing.h"
+#include "glstate.h"
+
+#include <algorithm>
+
+// Visible instances gathered for one upload, kept to reuse its memory
+static std::vector<InstanceData> packedInstances;
+
+InstanceBuffer* CreateInstanceBuffer(unsigned int count, const glm::mat4* transforms, const glm::vec4* colors)
+{
+	InstanceBuffer* instances = new InstanceBuffer();
+	instances->instances.resize(count);
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		instances->instances[i].matrix = transforms[i];
+		instances->instances[i].color = colors != nullptr ? colors[i] : glm::vec4(1.0f);
+	}
+
+	glGenBuffers(1, &instances->buffer);
+
+	return instances;
+}
+
+void DestroyInstanceBuffer(InstanceBuffer* instances)
+{
+	for (unsigned int i = 0; i < VERTEX_FORMAT_COUNT; i++)
+	{
+		if (instances->vertexArrays[i] != 0)
+			DeleteInstancedVertexArray(instances->vertexArrays[i]);
+	}
+
+	StateDeleteBuffers(1, &instances->buffer);
+
+	delete instances;
+}
+
+// True if an element of the GPU buffer needs copying again to hold instance
+static bool ElementChanged(const InstanceBuffer* instances, unsigned int element, unsigned int instance)
+{
+	return element >= instances->uploaded.size() || instances->uploaded[element] != instance;
+}
+
+void UploadInstances(InstanceBuffer* instances, const std::vector<unsigned int>& visible)
+{
+	unsigned int count = visible.size();
+	unsigned int first = 0, last = count;
+
+	StateBindBuffer(GL_ARRAY_BUFFER, instances->buffer);
+
+	// Grow by doubling, respecifying the same buffer name so the vertex arrays still point at it
+	if (count > instances->capacity)
+	{
+		unsigned int capacity = std::max(instances->capacity, 64u);
+
+		while (capacity < count)
+			capacity *= 2;
+
+		StateBufferData(GL_ARRAY_BUFFER, capacity * sizeof(InstanceData), NULL, GL_DYNAMIC_DRAW);
+		instances->capacity = capacity;
+
+		// The old contents are gone, so everything needs uploading
+		instances->uploaded.clear();
+	}
+
+	// Elements before the first and after the last that changed already hold the right instance
+	while (first < last && !ElementChanged(instances, first, visible[first]))
+		first++;
+
+	while (last > first && !ElementChanged(instances, last - 1, visible[last - 1]))
+		last--;
+
+	if (first < last)
+	{
+		packedInstances.clear();
+
+		for (unsigned int i = first; i < last; i++)
+			packedInstances.push_back(instances->instances[visible[i]]);
+
+		StateBufferSubData(GL_ARRAY_BUFFER, first * sizeof(InstanceData), packedInstances.size() * sizeof(InstanceData), packedInstances.data());
+	}
+
+	instances->uploaded = visible;
+}
+
+void DrawInstances(InstanceBuffer* instances, const GeometryAllocation& geometry)
+{
+	if (instances->uploaded.empty())
+		return;
+
+	GLuint& vertexArray = instances->vertexArrays[geometry.format];
+
+	if (vertexArray == 0)
+		vertexArray = CreateInstancedVertexArray(geometry.format, instances->buffer);
+
+	StateBindVertexArray(vertexArray);
+	StateDrawElementsInstancedBaseVertex(GL_TRIANGLES, geometry.indexCount, GL_UNSIGNED_INT, (void*)(geometry.firstIndex * sizeof(unsigned int)), instances->uploaded.size(), geometry.baseVertex);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "geometry.h"
+
+// Struct to hold a set of instances that are drawn together, one InstanceData per instance. The GPU buffer
+// holds just the visible instances, packed together, and only the span whose instances changed since the
+// last upload is copied. The instances are fixed once created: the main thread reads them for culling while
+// the render thread reads them for uploads, so there is no safe point to edit them.
+struct InstanceBuffer
+{
+	std::vector<InstanceData> instances; // instanceMatrix is the model matrix, instanceColor multiplies the material color
+	GLuint buffer = 0;
+	GLuint vertexArrays[VERTEX_FORMAT_COUNT] = { 0 }; // created the first time a format is drawn
+	unsigned int capacity = 0; // instances the GPU buffer can hold
+	std::vector<unsigned int> uploaded; // which instance each element of the GPU buffer holds, as of the last upload
+};
+
+// Create a buffer holding count instances. colors can be null, in which case every instance is white.
+InstanceBuffer* CreateInstanceBuffer(unsigned int count, const glm::mat4* transforms, const glm::vec4* colors = nullptr);
+void DestroyInstanceBuffer(InstanceBuffer* instances);
+
+// Pack the visible instances, indices in increasing order, into the GPU buffer, growing it if they no longer
+// fit. Only the span from the first element that holds a different instance to the last is copied. Call
+// before drawing.
+void UploadInstances(InstanceBuffer* instances, const std::vector<unsigned int>& visible);
+
+// Draw one piece of pool geometry once per uploaded instance, with glDrawElementsInstancedBaseVertex
+void DrawInstances(InstanceBuffer* instances, const GeometryAllocation& geometry);
@@ -1,7 +1,14 @@
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <vector>
-#include <fstream>
+#include <cfloat>
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include <SDL/SDL.h>
 #include <SDL/SDL_image.h>
@@ -16,6 +23,24 @@
 #include <GLM/glm.hpp>
 #include <GLM/ext.hpp>
 
+#include "maths.h"
+#include "shader.h"
+#include "glstate.h"
+#include "drawlist.h"
+#include "geometry.h"
+#include "indirect.h"
+#include "instancing.h"
+#include "ringbuffer.h"
+#include "culling.h"
+#include "occlusion.h"
+#include "timing.h"
+#include "gpuprofiler.h"
+#include "trace.h"
+#include "startup.h"
+#include "headless.h"
+#include "framestats.h"
+#include "assetmemory.h"
+
 // Convience function to convert between degrees and radians
 const float PI = 3.14159265359f;
 float Radians(float degrees) { return degrees * (PI / 180.0f); }
@@ -26,11 +51,10 @@ struct Mesh
 {
 	unsigned int drawCount = 0;
 	unsigned int materialIndex = 0;
-	GLuint indexBuffer;
-	GLuint vertexBuffer;
-	GLuint uvBuffer;
-	GLuint vertexArrayObject; 
+	GeometryAllocation geometry; // where the mesh lives in the shared geometry pool
 	bool hasUvs = false;
+	Bounds bounds; // box and sphere in model space, for culling and depth sorting
+	Occluder* occluder = nullptr; // CPU copy of the triangles if this is one of the model's occluders
 };
 
 // Struct to hold material loaded into OpenGL
@@ -39,6 +63,9 @@ struct Material
 	glm::vec3 diffuseColor;
 	GLuint diffuseTexture;
 	bool hasDiffuseTexture;
+	ShaderProgram* program = nullptr; // program this material is drawn with
+	ShaderProgram* indirectProgram = nullptr; // program for the multi-draw indirect path, reading per draw attributes instead of uniforms
+	ShaderProgram* instancedProgram = nullptr; // program for drawing many instances, reading a model matrix and tint per instance
 };
 
 // Struct to hold a loaded model
@@ -46,20 +73,49 @@ struct Model
 {
 std::vector<Mesh*> meshes;
 std::vector<Material*> materials;
+Bounds bounds; // encloses every mesh, in model space
+};
+
+// Struct matching the std140 layout of the Camera uniform block declared in the shaders
+struct CameraBlock
+{
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::mat4 viewProjection;
+	glm::vec4 position; // vec3 padded to a vec4, as std140 does
 };
 
 // OpenGL version
 const unsigned int GL_VERSION_MAJOR = 3;
-const unsigned int GL_VERSION_MINOR = 1;
+const unsigned int GL_VERSION_MINOR = 3;
 
 // Model variables
 glm::vec3 modelPosition = glm::vec3(0.0f, 0.0f, 0.0f);
 glm::vec3 modelScale = glm::vec3(1.0f, 1.0f, 1.0f);
 glm::vec3 modelRotation = glm::vec3(0.0f, 0.0f, 0.0f); // euler angles in radians
 glm::mat4 modelMatrix;
+glm::mat4 modelViewProjection; // combined on the CPU once per object, rather than per vertex
 const std::string modelFile = "models/Crate.obj";
 Model* model;
 
+// Struct to hold a post-processing step applied to the model. See http://assimp.sourceforge.net/lib_html/postprocess_8h.html for more information.
+struct PostProcessStep
+{
+	aiPostProcessSteps flag;
+	const char* name;
+};
+
+// Steps are applied one at a time so each can be timed, in the order Assimp runs them when they are passed to ReadFile together, so the result is the same
+const PostProcessStep POST_PROCESS_STEPS[] =
+{
+	{ aiProcess_FlipUVs, "FlipUVs" },
+	{ aiProcess_OptimizeMeshes, "OptimizeMeshes" },
+	{ aiProcess_GenUVCoords, "GenUVCoords" },
+	{ aiProcess_TransformUVCoords, "TransformUVCoords" },
+	{ aiProcess_Triangulate, "Triangulate" },
+	{ aiProcess_JoinIdenticalVertices, "JoinIdenticalVertices" }
+};
+
 // Camera variables
 glm::vec3 cameraPosition = glm::vec3(0.0f, 0.0f, 5.0f);
 glm::vec3 cameraRotation = glm::vec3(0.0f, 0.0f, 0.0f); // euler angles in radians
@@ -68,19 +124,164 @@ float zNear = 0.01f;
 float zFar = 1000.0f;
 glm::mat4 cameraView;
 glm::mat4 cameraProjection;
+glm::mat4 cameraViewProjection;
+
+// Per frame data (camera block, indirect commands and per draw data) is streamed through the ring buffer
+const GLsizeiptr RING_FRAME_SIZE = 4 * 1024 * 1024;
+GLint uniformBufferAlignment = 256; // uniform block offsets must be a multiple of this
 
 // Shader variables
-GLuint shaderProgram;
-GLuint vertexShader;
-GLuint fragmentShader;
-GLuint vertexAttrib;
-GLuint uvAttrib;
-GLuint modelMatUniform;
-GLuint cameraViewMatUniform;
-GLuint cameraProjMatUniform;
-GLuint diffuseTextureUniform;
-GLuint hasDiffuseTextureUniform;
-GLuint diffuseColorUniform;
+ShaderProgram* texturedProgram; // materials with a diffuse texture
+ShaderProgram* colorProgram; // materials with only a diffuse color
+ShaderProgram* texturedIndirectProgram;
+ShaderProgram* colorIndirectProgram;
+ShaderProgram* texturedInstancedProgram;
+ShaderProgram* colorInstancedProgram;
+ShaderProgram* depthProgram; // depth pre-pass, no color output
+ShaderProgram* depthIndirectProgram;
+
+// Draw list sorting, the list itself is rebuilt every frame in the frame packet
+std::vector<DrawItem> drawListScratch;
+DrawSortMode drawSortMode = SORT_BY_STATE;
+
+// Struct to hold a run of sorted draws that share state, submitted with one multi-draw indirect call
+struct IndirectBucket
+{
+	ShaderProgram* program;
+	GLuint texture;
+	VertexFormat format;
+	unsigned int firstCommand;
+	unsigned int commandCount;
+};
+
+// Culling variables, meshes outside the camera frustum are skipped each frame
+bool frustumCulling = true;
+Frustum cameraFrustum;
+BoxList meshBoxes; // world space boxes, one per mesh
+std::vector<unsigned char> meshVisible; // one per mesh, set in Update
+unsigned int drawnMeshCount = 0;
+unsigned int culledMeshCount = 0;
+
+// Occlusion culling variables. The largest meshes with few enough triangles are drawn into a software depth buffer and hide the meshes behind them.
+const unsigned int MAX_OCCLUDERS = 8;
+const unsigned int MAX_OCCLUDER_TRIANGLES = 4096;
+bool occlusionCulling = true;
+unsigned int occludedMeshCount = 0;
+
+// Multi-draw indirect variables
+bool indirectDrawSupported = false;
+bool useIndirectDraws = false;
+std::vector<IndirectBucket> indirectBuckets;
+std::vector<IndirectBucket> depthIndirectBuckets; // pre-pass commands, written in the same upload as the main pass
+
+// Depth pre-pass variables. The pre-pass lays down depth nearest first, then the main pass only shades the visible fragments.
+bool depthPrePass = false;
+
+// Profiling variables. Every render pass is timed on the CPU and the GPU, with profileBuckets each indirect bucket is too.
+bool profileBuckets = false;
+
+// Instancing variables, a grid of copies of the model drawn with one call per mesh
+const unsigned int INSTANCE_GRID_SIZE = 100; // 100 x 100 instances
+const float INSTANCE_GRID_SPACING = 4.0f;
+InstanceBuffer* gridInstances = nullptr;
+bool drawGridInstances = false;
+BoxList gridBoxes; // world space boxes, one per instance
+std::vector<unsigned char> gridInstanceVisible; // one per instance, set in Update
+std::vector<unsigned int> gridVisible; // indices of the instances that passed culling
+
+// Struct to hold everything the render thread needs to draw one frame. The main thread fills one in
+// Update, and once it is handed over the render thread only reads it.
+struct FramePacket
+{
+	// Camera
+	glm::mat4 cameraView;
+	glm::mat4 cameraProjection;
+	glm::mat4 cameraViewProjection;
+	glm::vec3 cameraPosition;
+	
+	// Model, the per draw data for every mesh
+	glm::mat4 modelMatrix;
+	glm::mat4 modelViewProjection;
+	
+	// Visible meshes, sorted
+	std::vector<DrawItem> drawList;
+	std::vector<DrawItem> depthDrawList; // the same meshes nearest first, for the depth pre-pass
+	std::vector<unsigned int> gridVisible; // grid instances that passed culling, in order
+	
+	// Settings for this frame
+	unsigned int displayWidth = 0;
+	unsigned int displayHeight = 0;
+	bool useIndirectDraws = false;
+	bool drawGridInstances = false;
+	bool depthPrePass = false;
+	bool profileBuckets = false;
+	
+	// Print stats after drawing, with the main thread's culling counts
+	bool printStats = false;
+	double mainMilliseconds = 0.0; // main thread work for this frame, not counting waits
+	unsigned int drawnMeshCount = 0;
+	unsigned int culledMeshCount = 0;
+	unsigned int occludedMeshCount = 0;
+};
+
+// Render thread variables. Two packets: the main thread fills one while the render thread draws the other.
+// SDL's Cocoa backend only allows window calls, swapping included, on the main thread, so on Apple
+// platforms each packet is drawn on the main thread as soon as it is submitted instead.
+#ifdef __APPLE__
+const bool USE_RENDER_THREAD = false;
+#else
+const bool USE_RENDER_THREAD = true;
+#endif
+FramePacket framePackets[2];
+unsigned int framePacketWrite = 0; // packet the main thread fills next
+int framePacketPending = -1; // packet handed over but not yet taken by the render thread
+bool renderThreadQuit = false;
+std::thread renderThread;
+std::mutex framePacketMutex;
+std::condition_variable framePacketSubmitted;
+std::condition_variable framePacketTaken;
+unsigned int viewportWidth = 0; // viewport size last set, so it is only changed on resize
+unsigned int viewportHeight = 0;
+
+// How frames are presented, picked with --present on the command line
+enum PresentMode
+{
+	PRESENT_VSYNC, // swap interval 1, wait for vertical blank
+	PRESENT_ADAPTIVE, // swap interval -1, wait for vertical blank unless the frame is late, then tear. Falls back to vsync.
+	PRESENT_OFF, // swap interval 0, as fast as possible
+	PRESENT_LIMITED // swap interval 0, paced to --fps by sleeping then spinning
+};
+
+// Presentation variables
+PresentMode presentMode = PRESENT_VSYNC;
+float targetFrameRate = 120.0f; // for PRESENT_LIMITED
+Uint64 nextPresentCounter = 0; // when the limiter lets the next frame be presented
+Uint64 lastPresentCounter = 0;
+RunningStats presentIntervals; // milliseconds between presents, since the last F1
+
+// CPU trace, recorded for the whole run and written out at exit when --trace is given
+std::string traceFile;
+
+// Startup timeline, always printed, and written as CSV when --startup is given
+std::string startupFile;
+bool startupReported = false; // set once the first present, or quitting, has ended startup
+
+// Headless benchmark, drawing a fixed number of frames into a framebuffer along a scripted camera path, then exiting
+bool headless = false;
+unsigned int headlessWidth = 1280;
+unsigned int headlessHeight = 720;
+unsigned int headlessFrameCount = 1000;
+Uint64 headlessStartCounter = 0;
+
+// Frame statistics, printed every statsInterval seconds with --stats and written as CSV with --stats-csv. Only used on the render thread once it starts.
+double statsInterval = 0.0; // 0 for only on F1
+std::string statsFile;
+Uint64 startCounter = 0;
+Uint64 nextStatsCounter = 0;
+
+// Main thread work timing for the frame being prepared
+Uint64 frameStartCounter = 0;
+Uint64 framePacketWaitCounter = 0; // time spent waiting for a free packet
 
 // Display variables
 SDL_Window *window;
@@ -88,68 +289,367 @@ SDL_GLContext context;
 unsigned int displayWidth = 800;
 unsigned int displayHeight = 800;
 
+// Struct to hold the state the simulation steps, so frames can be drawn in between two steps
+struct SimulationState
+{
+	glm::vec3 modelPosition;
+	glm::vec3 modelScale;
+	glm::vec3 modelRotation;
+	glm::vec3 cameraPosition;
+	glm::vec3 cameraRotation;
+};
+
 // Program variables
 bool quit = false;
-float deltaTime = 0.0f;
+float frameTime = 0.0f; // seconds from the start of the last frame to the start of this one
+const float SIMULATION_TIMESTEP = 1.0f / 120.0f; // the simulation always steps by this much
+const float MAX_FRAME_TIME = 0.25f; // longest frame the simulation catches up on, the rest of a long stall is dropped
+SimulationState previousState; // state before the last simulation step
+SimulationState renderState; // state drawn this frame, between previousState and the current state
+bool printStats = false; // set by F1, printed by the render thread
 
+bool ParseArguments(int argc, char *argv[]); // read settings from the command line
 void InitialiseSDL(); // SDL_Init()
 void CreateWindow(); // Open a new window
 void SetGLAttributes(); // Set various GL attribs
 void CreateContext(); // Create a OpenGL context to render into
 void InitialiseGlew(); // glewInit()
+void SetPresentMode(); // set the swap interval for the presentation mode
+void CreateHeadless(); // EGL context and framebuffer in place of the window
+bool MakeContextCurrent(bool current); // make the window's or headless context current on this thread, or release it
+void LimitFrameRate(); // wait until the next frame is due, with PRESENT_LIMITED
+void RecordPresent(); // add the interval since the last present to the pacing stats
+void UpdateFrameStatsOutput(); // print and write the frame statistics when they are due
+void PrintFramePacing(); // print the present interval mean and variance
+void PrintGLCounters(const GLStateStats& stats); // print draw, bind, uniform and upload counts
 void LoadShader(); // load shader
+void CreateFrameBuffers(); // create the per frame ring buffer and start the GPU profiler
 void LoadModel(); // load model
-void Update(float deltaTime); // main update function
-void Render(); // main render function
+unsigned long long SceneBytes(const Assimp::Importer& importer); // memory held by the importer's scene
+void PrintMemoryReport(); // memory per loaded asset, and the geometry pools they share
+void ProcessEvents(); // handle SDL events, once per frame
+void Simulate(float timestep); // step the simulation by a fixed timestep
+void FollowCameraPath(float t); // put the camera on the scripted path, t from 0 to 1
+void RunHeadless(); // draw every scripted frame, without input
+void PrintHeadlessTiming(); // wait for the GPU and print how long the scripted frames took
+SimulationState CaptureSimulationState(); // copy of the current simulation state
+SimulationState InterpolateSimulationState(const SimulationState& from, const SimulationState& to, float t); // blend two states
+void Update(float interpolation); // main update function, prepares the frame between the last two simulation steps
+void BuildFramePacket(FramePacket& packet); // fill a frame packet from the current simulation state
+FramePacket& BeginFramePacket(); // wait until the next packet is free to write
+void SubmitFramePacket(); // hand the packet to the render thread
+void StartRenderThread(); // release the context and start drawing on the render thread, where swapping from it is supported
+void StopRenderThread(); // stop the render thread and take the context back
+void ReportStartupTimeline(); // end the startup timeline and print and write it, once
+void RenderThread(); // render thread loop
+void DrawFramePacket(const FramePacket& packet); // resize the viewport if needed, then render, on whichever thread draws
+void Render(const FramePacket& packet); // main render function
+void DrawLoop(const FramePacket& packet); // draw the sorted draw list one call at a time
+void DrawDepthLoop(const FramePacket& packet); // draw the depth pre-pass one call at a time
+bool BuildIndirectDraws(const FramePacket& packet); // turn the sorted draw lists into multi-draw indirect commands
+void AddIndirectBuckets(const FramePacket& packet, const std::vector<DrawItem>& drawList, bool depthOnly, std::vector<IndirectBucket>& buckets, unsigned int& commandCount); // commands for one draw list
+void DrawIndirect(const std::vector<IndirectBucket>& buckets, bool profile); // draw buckets of commands with multi-draw indirect, optionally timing each one
+void CreateGridInstances(); // fill an instance buffer with a grid of transforms and colors
+void CullGridInstances(); // frustum cull the grid instances, adding them to the mesh counts
+void DrawModelInstances(Model* model, InstanceBuffer* instances, const std::vector<unsigned int>& visible); // draw every mesh of a model once per visible instance
 void UnloadModel(); // unload model
 void UnloadShader(); // unload shader
+void DestroyFrameBuffers(); // delete the per frame ring buffer and the GPU profiler's queries
 void Quit();
 
 int main(int argc, char *argv[])
 {
-	// Setup
+	// Everything is timed from here
+	startCounter = SDL_GetPerformanceCounter();
+	
+	// Settings
+	BeginStartupPhase("Arguments");
+	
+	if (!ParseArguments(argc, argv))
+		return 1;
+	
+	EndStartupPhase();
+	
+	// Start recording before any other thread exists
+	if (!traceFile.empty())
+	{
+		StartTrace();
+		SetTraceThreadName("Main");
+	}
+	
+	// Setup, timing each step
+	BeginStartupPhase("SDL init");
 	InitialiseSDL();
-	CreateWindow();
-	SetGLAttributes();
-	CreateContext();
+	EndStartupPhase();
+	
+	BeginStartupPhase("Window and context");
+	
+	if (headless)
+	{
+		CreateHeadless();
+	}
+	else
+	{
+		SetGLAttributes(); // before the window, as the pixel format is picked when it is created
+		CreateWindow();
+		CreateContext();
+	}
+	
+	EndStartupPhase();
+	
+	BeginStartupPhase("GLEW");
 	InitialiseGlew();
+	EndStartupPhase();
+	
+	// Headless frames go to a framebuffer object at the size asked for
+	if (headless && !CreateHeadlessFramebuffer(headlessWidth, headlessHeight))
+	{
+		Quit();
+		return 1;
+	}
 	
 	// Load shader
+	BeginStartupPhase("Shader submit");
 	LoadShader();
+	EndStartupPhase();
+	
+	// Create the ring buffer for per frame data
+	BeginStartupPhase("Frame buffers");
+	CreateFrameBuffers();
+	EndStartupPhase();
+	
+	// Start the occlusion culling threads, leaving a core for this thread
+	BeginStartupPhase("Occlusion threads");
+	InitialiseOcclusion(std::min(std::max(std::thread::hardware_concurrency(), 1u) - 1, 3u));
+	EndStartupPhase();
 	
 	// Load the model
+	BeginStartupPhase("Load model");
 	LoadModel();
+	EndStartupPhase();
+	
+	// Use multi-draw indirect if we can
+	indirectDrawSupported = IndirectDrawSupported();
+	useIndirectDraws = indirectDrawSupported;
+	std::cout << "Multi-draw indirect: " << (indirectDrawSupported ? "yes" : "no") << std::endl;
+	
+	if (indirectDrawSupported)
+	{
+		BeginStartupPhase("Indirect vertex arrays");
+		CreateIndirectVertexArrays();
+		EndStartupPhase();
+	}
+	
+	// Instances of the model to draw with instancing
+	BeginStartupPhase("Grid instances");
+	CreateGridInstances();
+	EndStartupPhase();
+	
+	// Make sure every shader has finished compiling before the first frame, and report how long it took
+	BeginStartupPhase("Shader compile and link");
+	FinishShaderPrograms();
+	EndStartupPhase();
+	
+	// Everything is loaded, GL is only used from the render thread from here
+	BeginStartupPhase("Start render thread");
+	StartRenderThread();
+	EndStartupPhase();
+	
+	// Startup runs up to the first present, where the render thread ends this phase and reports the timeline
+	BeginStartupPhase("First frame");
+	
+	// Frame statistics file, written by the render thread
+	if (!statsFile.empty() && !OpenFrameStatsFile(statsFile))
+		std::cout << "Error opening frame statistics file: " << statsFile << std::endl;
+	
+	// High resolution frame clock, and time not yet simulated
+	Uint64 counterFrequency = SDL_GetPerformanceFrequency();
+	Uint64 lastCounter = SDL_GetPerformanceCounter();
+	float accumulator = 0.0f;
+	previousState = CaptureSimulationState();
+	
+	// Scripted frames only, the loop below is skipped
+	if (headless)
+		RunHeadless();
 	
 	while(!quit)
 	{	
-		// Frame timing
-		unsigned int startTime = SDL_GetTicks();
+		TRACE_SCOPE("Frame");
 		
-		// Update simulation, then render
-		Update(deltaTime);
-		Render();
-
-		// Calculate deltatime
-		unsigned int endTime = SDL_GetTicks();
-		deltaTime = (endTime - startTime) / 1000.0f;
+		// Full frame to frame interval, including waiting for the render thread
+		Uint64 counter = SDL_GetPerformanceCounter();
+		frameTime = (float)((double)(counter - lastCounter) / counterFrequency);
+		lastCounter = counter;
+		frameStartCounter = counter;
+		
+		// Input is handled every frame
+		ProcessEvents();
+		
+		// Step the simulation at a fixed rate, as many times as the elapsed time covers
+		accumulator += std::min(frameTime, MAX_FRAME_TIME);
+		
+		while (accumulator >= SIMULATION_TIMESTEP)
+		{
+			TRACE_SCOPE("Simulate");
+			previousState = CaptureSimulationState();
+			Simulate(SIMULATION_TIMESTEP);
+			accumulator -= SIMULATION_TIMESTEP;
+		}
+		
+		// Prepare the frame part way between the last two steps, and hand it over. The render thread draws it while we move on to the next one.
+		Update(accumulator / SIMULATION_TIMESTEP);
+		SubmitFramePacket();
 	};
 	
+	// Wait for the last frame, and take the context back for cleanup
+	StopRenderThread();
+	
+	// In case we quit before anything was presented
+	ReportStartupTimeline();
+	
+	if (headless)
+		PrintHeadlessTiming();
+	
+	CloseFrameStatsFile();
+	
+	// How evenly frames were presented
+	PrintFramePacing();
+	
+	// Delete the instances
+	DestroyInstanceBuffer(gridInstances);
+	
+	// Delete the indirect vertex arrays
+	if (indirectDrawSupported)
+		DestroyIndirectVertexArrays();
+	
+	// What the assets held, before they go
+	PrintMemoryReport();
+	
 	// Unload the model
 	UnloadModel();
 	
 	// Unload shader
 	UnloadShader();
 	
+	// Stop the occlusion culling threads
+	ShutdownOcclusion();
+	
+	// Delete the ring buffer
+	DestroyFrameBuffers();
+	
+	// Every other thread has stopped, so the trace is complete
+	if (!traceFile.empty())
+	{
+		if (WriteTrace(traceFile))
+			std::cout << "Trace written to " << traceFile << std::endl;
+		else
+			std::cout << "Error writing trace: " << traceFile << std::endl;
+		
+		ClearTrace();
+	}
+	
 	// Cleanup
 	Quit();
 	
 	return 0;	
 }
 
+bool ParseArguments(int argc, char *argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string argument = argv[i];
+		
+		if (argument == "--present" && i + 1 < argc)
+		{
+			std::string mode = argv[++i];
+			
+			if (mode == "vsync")
+				presentMode = PRESENT_VSYNC;
+			else if (mode == "adaptive")
+				presentMode = PRESENT_ADAPTIVE;
+			else if (mode == "off")
+				presentMode = PRESENT_OFF;
+			else if (mode == "limited")
+				presentMode = PRESENT_LIMITED;
+			else
+			{
+				std::cout << "Unknown presentation mode: " << mode << std::endl;
+				return false;
+			}
+		}
+		else if (argument == "--fps" && i + 1 < argc)
+		{
+			targetFrameRate = (float)atof(argv[++i]);
+			
+			if (targetFrameRate <= 0.0f)
+			{
+				std::cout << "Target frame rate must be above 0" << std::endl;
+				return false;
+			}
+			
+			// Asking for a frame rate implies the limiter
+			presentMode = PRESENT_LIMITED;
+		}
+		else if (argument == "--trace" && i + 1 < argc)
+		{
+			traceFile = argv[++i];
+		}
+		else if (argument == "--startup" && i + 1 < argc)
+		{
+			startupFile = argv[++i];
+		}
+		else if (argument == "--stats" && i + 1 < argc)
+		{
+			statsInterval = atof(argv[++i]);
+			
+			if (statsInterval <= 0.0)
+			{
+				std::cout << "Statistics interval must be above 0" << std::endl;
+				return false;
+			}
+		}
+		else if (argument == "--stats-csv" && i + 1 < argc)
+		{
+			statsFile = argv[++i];
+		}
+		else if (argument == "--headless")
+		{
+			headless = true;
+		}
+		else if (argument == "--size" && i + 1 < argc)
+		{
+			if (sscanf(argv[++i], "%ux%u", &headlessWidth, &headlessHeight) != 2 || headlessWidth == 0 || headlessHeight == 0)
+			{
+				std::cout << "Size must be given as widthxheight, e.g. 1920x1080" << std::endl;
+				return false;
+			}
+		}
+		else if (argument == "--frames" && i + 1 < argc)
+		{
+			headlessFrameCount = (unsigned int)atoi(argv[++i]);
+			
+			if (headlessFrameCount == 0)
+			{
+				std::cout << "Frame count must be above 0" << std::endl;
+				return false;
+			}
+		}
+		else
+		{
+			std::cout << "Unknown argument: " << argument << std::endl;
+			std::cout << "Usage: Demo [--present vsync|adaptive|off|limited] [--fps target] [--trace file.json] [--startup file.csv] [--stats seconds] [--stats-csv file.csv] [--headless [--size widthxheight] [--frames count]]" << std::endl;
+			return false;
+		}
+	}
+	
+	return true;
+}
+
 void InitialiseSDL()
 {
-	// Init SDL
-	if(SDL_Init(SDL_INIT_EVERYTHING) != 0)
+	// Init SDL, headless only needs the timer
+	if(SDL_Init(headless ? SDL_INIT_TIMER : SDL_INIT_EVERYTHING) != 0)
 	{
 		std::cout << "SDL initialisation failed!" << std::endl;
 		exit(1);
@@ -184,6 +684,7 @@ void SetGLAttributes()
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, GL_VERSION_MINOR); // version minor
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE); // core profile
 	SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1); // double buffering
+	SDL_GL_SetAttribute(SDL_GL_FRAMEBUFFER_SRGB_CAPABLE, 1); // sRGB framebuffer, so the hardware does gamma correction
 }
 
 void CreateContext()
@@ -206,6 +707,27 @@ void CreateContext()
 	}
 }
 
+void CreateHeadless()
+{
+	// Draw at the size asked for, the framebuffer is created once GLEW is ready
+	displayWidth = headlessWidth;
+	displayHeight = headlessHeight;
+	
+	if (!CreateHeadlessContext(GL_VERSION_MAJOR, GL_VERSION_MINOR))
+	{
+		SDL_Quit();
+		exit(1);
+	}
+}
+
+bool MakeContextCurrent(bool current)
+{
+	if (headless)
+		return MakeHeadlessContextCurrent(current);
+	
+	return SDL_GL_MakeCurrent(window, current ? context : nullptr) == 0;
+}
+
 void InitialiseGlew()
 {
 	// Modern OpenGL
@@ -215,7 +737,7 @@ void InitialiseGlew()
 	GLenum glew = glewInit();
 
 	// Check glew status
-	if (glew != GLEW_OK)
+	if (glew != GLEW_OK && !(headless && glew == GLEW_ERROR_NO_GLX_DISPLAY))
 	{
 		// Error
 		std::cout << "Glew initialisation failed!" << std::endl;
@@ -228,6 +750,9 @@ void InitialiseGlew()
 		exit(1);
 	}
 	
+	// Start with no assumptions about the GL state
+	ResetGLState();
+	
 	// Print OpenGL info
 	std::cout << "Glew initialised!" << std::endl;
 	std::cout << "OpenGL version: " << glGetString(GL_VERSION) << std::endl;
@@ -236,143 +761,232 @@ void InitialiseGlew()
 	std::cout << "Renderer: " << glGetString(GL_RENDERER) << std::endl;
 	
 	// Enable back face culling with counter-clockwise winding for front faces
-	glEnable(GL_CULL_FACE);
-	glCullFace(GL_BACK);
-	glFrontFace(GL_CCW);
+	StateEnable(GL_CULL_FACE);
+	StateCullFace(GL_BACK);
+	StateFrontFace(GL_CCW);
 
 	// Enable depth testing
-	glEnable(GL_DEPTH_TEST);
-	glDepthFunc(GL_LEQUAL);
+	StateEnable(GL_DEPTH_TEST);
+	StateDepthFunc(GL_LEQUAL);
+	
+	// Convert linear shader output to sRGB when writing to the framebuffer
+	StateEnable(GL_FRAMEBUFFER_SRGB);
+	
+	// Check we actually got an sRGB framebuffer, otherwise output won't be gamma corrected. Headless draws to its own sRGB framebuffer.
+	if (!headless)
+	{
+		GLint colorEncoding = GL_LINEAR;
+		glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_BACK_LEFT, GL_FRAMEBUFFER_ATTACHMENT_COLOR_ENCODING, &colorEncoding);
+		
+		if (colorEncoding != GL_SRGB)
+			std::cout << "Warning: framebuffer is not sRGB capable, colors will be too dark" << std::endl;
+	}
 	
-	// Enable vsync
-	SDL_GL_SetSwapInterval(1);
+	// Vsync, or not, as asked for on the command line
+	SetPresentMode();
 	
 	// Set clear color
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 	glClearDepth(1.0f);
 }
 
-void Quit()
+void SetPresentMode()
 {
-	// Cleaup OpenGL context and window
-	SDL_GL_DeleteContext(context);
-	SDL_DestroyWindow(window);
+	// Nothing is presented headless, frames are only paced if limited
+	if (headless && presentMode != PRESENT_LIMITED)
+	{
+		std::cout << "Presentation: headless" << std::endl;
+		return;
+	}
 	
-	// Quit SDL
-	SDL_Quit();
-}
-
-std::string LoadShaderFromFile(const std::string& filename)
-{
-	std::ifstream file;
-	std::string source;
-	std::string line;
-
-	file.open(filename);
-
-	if (file.is_open())
+	// Adaptive vsync needs EXT_swap_control_tear or similar, use normal vsync if it isn't there
+	if (presentMode == PRESENT_ADAPTIVE && SDL_GL_SetSwapInterval(-1) != 0)
 	{
-		while (file.good())
-		{
-			getline(file, line);
-			source.append(line + "\n");
-		}
+		std::cout << "Adaptive vsync not supported, using vsync: " << SDL_GetError() << std::endl;
+		presentMode = PRESENT_VSYNC;
 	}
-	else
+	
+	// No swap interval without a window
+	if (!headless)
 	{
-		std::cout << "Couldn't open shader: " << filename << std::endl;
+		if (presentMode == PRESENT_VSYNC)
+			SDL_GL_SetSwapInterval(1);
+		else if (presentMode == PRESENT_OFF || presentMode == PRESENT_LIMITED)
+			SDL_GL_SetSwapInterval(0);
 	}
-
-	return source;
+	
+	const char* names[] = { "vsync", "adaptive vsync", "off", "limited" };
+	std::cout << "Presentation: " << names[presentMode];
+	
+	if (presentMode == PRESENT_LIMITED)
+		std::cout << " to " << targetFrameRate << " fps";
+	
+	std::cout << std::endl;
 }
 
-void LoadShader()
+void LimitFrameRate()
 {
-	// Create shader program
-	shaderProgram = glCreateProgram();
+	if (presentMode != PRESENT_LIMITED)
+		return;
 	
-	// Load shader source
-	std::string vertexSource = LoadShaderFromFile("shaders/shader.vert");
-	std::string fragmentSource = LoadShaderFromFile("shaders/shader.frag");
+	Uint64 now = SDL_GetPerformanceCounter();
+	Uint64 interval = SecondsToCounter(1.0 / targetFrameRate);
 	
-	// Create vertex shader
-	vertexShader = glCreateShader(GL_VERTEX_SHADER);
+	// Keep to a fixed schedule, so one slow frame doesn't shift every frame after it. If we have fallen a whole frame behind, start again from now rather than rushing to catch up.
+	if (nextPresentCounter == 0 || now > nextPresentCounter + interval)
+		nextPresentCounter = now;
 	
-	// Convert source to GLchar*
-	const GLchar* vertexSourceGL = vertexSource.c_str();
-	GLint vertexSourceLength = vertexSource.length();
+	WaitUntilCounter(nextPresentCounter);
+	nextPresentCounter += interval;
+}
 
-	// Compile shader
-	glShaderSource(vertexShader, 1, &vertexSourceGL, &vertexSourceLength);
-	glCompileShader(vertexShader);
+void RecordPresent()
+{
+	Uint64 now = SDL_GetPerformanceCounter();
 	
-	// Check compile status
-	GLint vertexStatus;
-	GLchar vertexError[1024] = { 0 };
-
-	glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &vertexStatus);
-
-	if (vertexStatus == GL_FALSE)
+	if (lastPresentCounter != 0)
 	{
-		glGetShaderInfoLog(vertexShader, sizeof(vertexError), NULL, vertexError);
-		std::cout << "Error compiling vertex shader: " << vertexError << std::endl;
+		double interval = CounterToSeconds(now - lastPresentCounter) * 1000.0;
+		presentIntervals.Add(interval);
+		AddFrameSample(FRAME_METRIC_PRESENT, interval);
 	}
 	
-	// Create fragment shader
-	fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-	
-	// Convert source to GLchar*
-	const GLchar* fragmentSourceGL = fragmentSource.c_str();
-	GLint fragmentSourceLength = fragmentSource.length();
+	lastPresentCounter = now;
+}
 
-	// Compile shader
-	glShaderSource(fragmentShader, 1, &fragmentSourceGL, &fragmentSourceLength);
-	glCompileShader(fragmentShader);
+void UpdateFrameStatsOutput()
+{
+	if (statsInterval <= 0.0 && statsFile.empty())
+		return;
+	
+	Uint64 now = SDL_GetPerformanceCounter();
+	
+	// Once a second for the file if there is no print interval
+	double interval = statsInterval > 0.0 ? statsInterval : 1.0;
+	
+	if (nextStatsCounter == 0)
+		nextStatsCounter = now + SecondsToCounter(interval);
 	
-	// Check compile status
-	GLint fragmentStatus;
-	GLchar fragmentError[1024] = { 0 };
+	if (now < nextStatsCounter)
+		return;
+	
+	if (statsInterval > 0.0)
+	{
+		PrintFrameStats();
+		PrintGLCounters(GetGLStateStats());
+	}
+	
+	WriteFrameStats(CounterToSeconds(now - startCounter));
+	nextStatsCounter = now + SecondsToCounter(interval);
+}
+
+void PrintGLCounters(const GLStateStats& stats)
+{
+	std::cout << "Draws: " << stats.drawCalls << " calls, " << stats.drawCommands << " commands, " << stats.triangles << " triangles" << std::endl;
+	std::cout << "Binds: " << stats.programBinds << " program, " << stats.vertexArrayBinds << " vertex array, " << stats.textureBinds << " texture, " << stats.uniformUploads << " uniform uploads" << std::endl;
+	std::cout << "Uploads: " << stats.bufferBytes / 1024.0 << " KB buffer, " << stats.textureBytes / 1024.0 << " KB texture" << std::endl;
+}
 
-	glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &fragmentStatus);
+void PrintFramePacing()
+{
+	if (presentIntervals.count == 0)
+		return;
+	
+	std::cout << "Frame pacing: " << presentIntervals.mean << " ms mean, " << presentIntervals.Variance() << " ms^2 variance (" << presentIntervals.StandardDeviation() << " ms std dev), " << presentIntervals.minimum << " to " << presentIntervals.maximum << " ms over " << presentIntervals.count << " frames" << std::endl;
+}
 
-	if (fragmentStatus == GL_FALSE)
+void Quit()
+{
+	// Cleaup OpenGL context and window
+	if (headless)
 	{
-		glGetShaderInfoLog(fragmentShader, sizeof(fragmentError), NULL, fragmentError);
-		std::cout << "Error compiling fragment shader: " << fragmentError << std::endl;
+		DestroyHeadlessFramebuffer();
+		DestroyHeadlessContext();
+	}
+	else
+	{
+		SDL_GL_DeleteContext(context);
+		SDL_DestroyWindow(window);
 	}
 	
-	// Attach shaders
-	glAttachShader(shaderProgram, vertexShader);
-	glAttachShader(shaderProgram, fragmentShader);
-	
-	// Link program
-	glLinkProgram(shaderProgram);
+	// Quit SDL
+	SDL_Quit();
+}
+
+void LoadShader()
+{
+	TRACE_SCOPE("LoadShader");
 	
-	// Validate program
-	glValidateProgram(shaderProgram);
+	// Check for parallel shader compile
+	InitialiseShaderManager();
 	
-	// Use program
-	glUseProgram(shaderProgram);
+	// Submit the compiles and links, the status is only checked when a program is first used
+	texturedProgram = QueueShaderProgram("textured", "shaders/shader.vert", "shaders/shader.frag");
+	colorProgram = QueueShaderProgram("color", "shaders/shader.vert", "shaders/color.frag");
+	texturedIndirectProgram = QueueShaderProgram("texturedIndirect", "shaders/indirect.vert", "shaders/shader.frag");
+	colorIndirectProgram = QueueShaderProgram("colorIndirect", "shaders/indirect.vert", "shaders/instanced.frag");
+	texturedInstancedProgram = QueueShaderProgram("texturedInstanced", "shaders/instanced.vert", "shaders/tinted.frag");
+	colorInstancedProgram = QueueShaderProgram("colorInstanced", "shaders/instanced.vert", "shaders/tintedcolor.frag");
+	depthProgram = QueueShaderProgram("depth", "shaders/shader.vert", "shaders/depth.frag");
+	depthIndirectProgram = QueueShaderProgram("depthIndirect", "shaders/indirect.vert", "shaders/depth.frag");
+}
+
+void CreateFrameBuffers()
+{
+	// The camera block is bound with glBindBufferRange, which has its own alignment rule
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformBufferAlignment);
 	
-	// Store attribs
-	vertexAttrib = glGetAttribLocation(shaderProgram, "vertex");
-	uvAttrib = glGetAttribLocation(shaderProgram, "uv");
+	// Triple buffered, persistently mapped if we can
+	CreateRingBuffer(RING_FRAME_SIZE);
 	
-	// Store uniforms
-	modelMatUniform = glGetUniformLocation(shaderProgram, "model");
-	cameraViewMatUniform = glGetUniformLocation(shaderProgram, "cameraView");
-	cameraProjMatUniform = glGetUniformLocation(shaderProgram, "cameraProjection");
-	diffuseTextureUniform = glGetUniformLocation(shaderProgram, "diffuseTexture");
-	hasDiffuseTextureUniform = glGetUniformLocation(shaderProgram, "hasDiffuseTexture");
-	diffuseColorUniform = glGetUniformLocation(shaderProgram, "diffuseColor");	
+	// Pass timings, queries are created as passes need them
+	InitialiseGPUProfiler();
+}
+
+void DestroyFrameBuffers()
+{
+	// Unmap and delete the ring buffer
+	DestroyRingBuffer();
 	
+	// Delete the timer queries
+	ShutdownGPUProfiler();
 }
 
 void LoadModel()
 {
-	// Use assimp to load a scene from the model file, and apply some post processing. See http://assimp.sourceforge.net/lib_html/postprocess_8h.html for more information.
+	TRACE_SCOPE("LoadModel");
+	
+	// Count the GL calls the load makes on their own, and account its memory to the model file
+	ResetGLStateStats();
+	BeginAssetMemory(modelFile);
+	
+	// Use assimp to load a scene from the model file, then apply the post processing steps
 	Assimp::Importer importer;
-	const aiScene* scene = importer.ReadFile(modelFile, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_GenUVCoords | aiProcess_TransformUVCoords | aiProcess_OptimizeMeshes | aiProcess_FlipUVs);
+	Uint64 importBegin = SDL_GetPerformanceCounter();
+	
+	BeginStartupPhase("Assimp read");
+	const aiScene* scene = importer.ReadFile(modelFile, 0);
+	EndStartupPhase();
+	
+	unsigned long long sceneBytes = SceneBytes(importer);
+	NoteImportMemory(sceneBytes, 0);
+	
+	for (const PostProcessStep& step : POST_PROCESS_STEPS)
+	{
+		if (!scene)
+			break;
+		
+		BeginStartupPhase(std::string("Assimp ") + step.name);
+		scene = importer.ApplyPostProcessing(step.flag);
+		EndStartupPhase();
+		
+		// Steps can grow the scene as well as shrink it
+		sceneBytes = SceneBytes(importer);
+		NoteImportMemory(sceneBytes, 0);
+	}
+	
+	if (TraceEnabled())
+		RecordTraceEvent("Assimp import", importBegin, SDL_GetPerformanceCounter());
 	
 	// Store the loaded model in a model struct
 	model = new Model();
@@ -384,11 +998,10 @@ void LoadModel()
 	else
 	{
 		std::cout << "Loaded model file: " << modelFile << std::endl;
-		
-		// Use shader
-		glUseProgram(shaderProgram);
 
 		// Loop through all the meshes in the scene
+		BeginStartupPhase("Mesh upload");
+		
 		for (unsigned int i = 0; i < scene->mNumMeshes; i++)
 		{
 			// Use a MeshStruct to store a mesh
@@ -396,8 +1009,7 @@ void LoadModel()
 			
 			// Vectors to store model data whilst we pass to OpenGL
 			std::vector<unsigned int> indices;
-			std::vector<glm::vec3> vertices;
-			std::vector<glm::vec2> uvs;
+			std::vector<float> vertices; // interleaved position and uv
 			
 			// Assimp stores indices in faces, these will all be triangles due to the aiProcess_Triangulate flag passed when loading the model
 			for (unsigned int j = 0; j < scene->mMeshes[i]->mNumFaces; j++)
@@ -409,84 +1021,147 @@ void LoadModel()
 				mesh->drawCount += 3;
 			}
 			
-			// Generate index buffer
-			glGenBuffers(1, &mesh->indexBuffer);
-			glBindBuffer(GL_ARRAY_BUFFER, mesh->indexBuffer);
-			glBufferData(GL_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+			// Check the model has uvs
+			mesh->hasUvs = scene->mMeshes[i]->mTextureCoords[0] != NULL;
+			VertexFormat format = mesh->hasUvs ? VERTEX_FORMAT_POSITION_UV : VERTEX_FORMAT_POSITION;
+			
+			// Track the bounds of the vertices
+			glm::vec3 minimum(FLT_MAX);
+			glm::vec3 maximum(-FLT_MAX);
+			
+			// Interleave vertices and uvs
+			vertices.reserve(scene->mMeshes[i]->mNumVertices * VertexFormatStride(format) / sizeof(float));
 			
-			// Push vertices and uvs back into their lists
 			for (unsigned int j = 0; j < scene->mMeshes[i]->mNumVertices; j++)
 			{
-				vertices.push_back(glm::vec3(scene->mMeshes[i]->mVertices[j].x, scene->mMeshes[i]->mVertices[j].y, scene->mMeshes[i]->mVertices[j].z));
-
-				// Check the model has uvs
-				if (scene->mMeshes[i]->mTextureCoords[0] != NULL)
-					uvs.push_back(glm::vec2(scene->mMeshes[i]->mTextureCoords[0][j].x, scene->mMeshes[i]->mTextureCoords[0][j].y));
+				glm::vec3 vertex(scene->mMeshes[i]->mVertices[j].x, scene->mMeshes[i]->mVertices[j].y, scene->mMeshes[i]->mVertices[j].z);
+				vertices.push_back(vertex.x);
+				vertices.push_back(vertex.y);
+				vertices.push_back(vertex.z);
+				minimum = glm::min(minimum, vertex);
+				maximum = glm::max(maximum, vertex);
+				
+				if (mesh->hasUvs)
+				{
+					vertices.push_back(scene->mMeshes[i]->mTextureCoords[0][j].x);
+					vertices.push_back(scene->mMeshes[i]->mTextureCoords[0][j].y);
+				}
 			}
 			
-			// Generate vertex buffer
-			glGenBuffers(1, &mesh->vertexBuffer);
-			glBindBuffer(GL_ARRAY_BUFFER, mesh->vertexBuffer);
-			glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), &vertices[0], GL_STATIC_DRAW);
+			// Box, and a sphere around its centre that is as tight as the vertices allow
+			mesh->bounds.minimum = minimum;
+			mesh->bounds.maximum = maximum;
+			mesh->bounds.sphereCenter = (minimum + maximum) * 0.5f;
 			
-			// Generate uv buffer if we have uvs
-			if(uvs.size() > 0)
+			for (unsigned int j = 0; j < scene->mMeshes[i]->mNumVertices; j++)
 			{
-				mesh->hasUvs = true;
-				glGenBuffers(1, &mesh->uvBuffer);
-				glBindBuffer(GL_ARRAY_BUFFER, mesh->uvBuffer);
-				glBufferData(GL_ARRAY_BUFFER, uvs.size() * sizeof(glm::vec2), &uvs[0], GL_STATIC_DRAW);	
+				glm::vec3 vertex(scene->mMeshes[i]->mVertices[j].x, scene->mMeshes[i]->mVertices[j].y, scene->mMeshes[i]->mVertices[j].z);
+				mesh->bounds.sphereRadius = glm::max(mesh->bounds.sphereRadius, glm::length(vertex - mesh->bounds.sphereCenter));
 			}
 			
-			// Store material index
-			mesh->materialIndex = scene->mMeshes[i]->mMaterialIndex;
-
-			// Generate vertex array object
-			glGenVertexArrays(1, &mesh->vertexArrayObject);
-							  
-			// Tell OpenGL how to interpret the model data
-			glBindVertexArray(mesh->vertexArrayObject);
-			
-			// Vertex buffer
-			glBindBuffer(GL_ARRAY_BUFFER, mesh->vertexBuffer);
-			glEnableVertexAttribArray(vertexAttrib);
-			glVertexAttribPointer(vertexAttrib, 3, GL_FLOAT, GL_FALSE, 0, 0);
-							  
-			// Uv buffer
-			if(mesh->hasUvs)
+			// Keep a CPU copy of small meshes, the largest of them become occluders
+			if (indices.size() / 3 <= MAX_OCCLUDER_TRIANGLES)
 			{
-				glBindBuffer(GL_ARRAY_BUFFER, mesh->uvBuffer);
-				glEnableVertexAttribArray(uvAttrib);
-				glVertexAttribPointer(uvAttrib, 2, GL_FLOAT, GL_FALSE, 0, 0);
+				mesh->occluder = new Occluder();
+				mesh->occluder->indices = indices;
+				mesh->occluder->vertices.reserve(scene->mMeshes[i]->mNumVertices);
+				
+				for (unsigned int j = 0; j < scene->mMeshes[i]->mNumVertices; j++)
+					mesh->occluder->vertices.push_back(glm::vec3(scene->mMeshes[i]->mVertices[j].x, scene->mMeshes[i]->mVertices[j].y, scene->mMeshes[i]->mVertices[j].z));
 			}
-							  
-			// Index buffer
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->indexBuffer);
-							  
-			// Unbind everything
-			glBindVertexArray(0);
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-			glBindBuffer(GL_ARRAY_BUFFER, 0);
-			glBindVertexArray(0);
+			
+			// The scene is still held while the vectors are at their largest
+			NoteImportMemory(sceneBytes, indices.capacity() * sizeof(unsigned int) + vertices.capacity() * sizeof(float));
+			
+			// Store material index
+			mesh->materialIndex = scene->mMeshes[i]->mMaterialIndex;
+			
+			// Copy into the shared vertex and index buffers, rather than giving every mesh its own buffers and vertex array
+			mesh->geometry = AllocateGeometry(format, vertices.data(), scene->mMeshes[i]->mNumVertices, indices.data(), indices.size());
 			
 			// Add to model
 			model->meshes.push_back(mesh);
 		}
-
-		// Loop through all the material in the scene
-		for (unsigned int i = 0; i < scene->mNumMaterials; i++)
+		
+		EndStartupPhase();
+		
+		// Bounds of the whole model, for a first culling test and for culling its instances
+		if (!model->meshes.empty())
 		{
-			// Store loaded material in material struct
-			Material* material = new Material();
-			
-			// Get the diffuse color of the material
-			scene->mMaterials[i]->Get(AI_MATKEY_COLOR_DIFFUSE, material->diffuseColor);
-
-			std::cout << material->diffuseColor.x << ", " << material->diffuseColor.y << ", " << material->diffuseColor.y << std::endl;
+			model->bounds.minimum = glm::vec3(FLT_MAX);
+			model->bounds.maximum = glm::vec3(-FLT_MAX);
+			
+			for (const Mesh* mesh : model->meshes)
+			{
+				model->bounds.minimum = glm::min(model->bounds.minimum, mesh->bounds.minimum);
+				model->bounds.maximum = glm::max(model->bounds.maximum, mesh->bounds.maximum);
+			}
+			
+			model->bounds.sphereCenter = (model->bounds.minimum + model->bounds.maximum) * 0.5f;
+			
+			for (const Mesh* mesh : model->meshes)
+				model->bounds.sphereRadius = glm::max(model->bounds.sphereRadius, glm::length(mesh->bounds.sphereCenter - model->bounds.sphereCenter) + mesh->bounds.sphereRadius);
+		}
+
+		// Only keep the largest occluders, small ones hide little and cost as much to rasterize
+		std::vector<Mesh*> occluders;
+		
+		for (Mesh* mesh : model->meshes)
+		{
+			if (mesh->occluder != nullptr)
+				occluders.push_back(mesh);
+		}
+		
+		std::sort(occluders.begin(), occluders.end(), [](const Mesh* a, const Mesh* b) { return a->bounds.sphereRadius > b->bounds.sphereRadius; });
+		
+		for (unsigned int j = MAX_OCCLUDERS; j < occluders.size(); j++)
+		{
+			delete occluders[j]->occluder;
+			occluders[j]->occluder = nullptr;
+		}
+		
+		std::cout << "Occluders: " << std::min((unsigned int)occluders.size(), MAX_OCCLUDERS) << std::endl;
+		
+		// Memory per mesh, now the occluders that keep a CPU copy are known
+		for (unsigned int i = 0; i < model->meshes.size(); i++)
+		{
+			const Mesh* mesh = model->meshes[i];
+			
+			MeshMemory memory;
+			memory.name = scene->mMeshes[i]->mName.length > 0 ? std::string(scene->mMeshes[i]->mName.C_Str()) : "mesh " + std::to_string(i);
+			memory.indexBytes = (unsigned long long)mesh->geometry.indexCount * sizeof(unsigned int);
+			memory.vertexBytes = (unsigned long long)mesh->geometry.vertexCount * 3 * sizeof(float);
+			memory.uvBytes = mesh->hasUvs ? (unsigned long long)mesh->geometry.vertexCount * 2 * sizeof(float) : 0;
+			
+			if (mesh->occluder != nullptr)
+				memory.cpuBytes = mesh->occluder->indices.size() * sizeof(unsigned int) + mesh->occluder->vertices.size() * sizeof(glm::vec3);
+			
+			AddMeshMemory(memory);
+		}
+
+		// Loop through all the material in the scene
+		for (unsigned int i = 0; i < scene->mNumMaterials; i++)
+		{
+			// Store loaded material in material struct
+			Material* material = new Material();
+			
+			// Get the diffuse color of the material
+			scene->mMaterials[i]->Get(AI_MATKEY_COLOR_DIFFUSE, material->diffuseColor);
+			
+			// Material colors are authored in sRGB, shaders work in linear space
+			material->diffuseColor = SRGBToLinear(material->diffuseColor);
+
+			std::cout << material->diffuseColor.x << ", " << material->diffuseColor.y << ", " << material->diffuseColor.y << std::endl;
+			
+			// Name for the memory report
+			aiString materialName;
+			scene->mMaterials[i]->Get(AI_MATKEY_NAME, materialName);
 			
 			// Check if the material has a diffuse texture
 			if (scene->mMaterials[i]->GetTextureCount(aiTextureType_DIFFUSE) > 0)
 			{
+				TRACE_SCOPE("Load texture");
+				
 				// Generate a texture
 				glGenTextures(1, &material->diffuseTexture);
 				
@@ -499,12 +1174,15 @@ void LoadModel()
 				std::string path = "models/" + std::string(filename.C_Str());
 				
 				// Load texture using SDL_image
+				BeginStartupPhase("Texture decode " + path);
 				SDL_Surface* texture = nullptr;
 				texture = IMG_Load(path.c_str());
+				EndStartupPhase();
 				
 				if (texture != nullptr)
 				{
-					glBindTexture(GL_TEXTURE_2D, material->diffuseTexture);
+					BeginStartupPhase("Texture upload " + path);
+					StateBindTextureUnit(DIFFUSE_TEXTURE_UNIT, GL_TEXTURE_2D, material->diffuseTexture);
 					
 					// Textures have to be passed to OpenGL in the right way depending on format. This is by no means a complete list, and some texture formats might still fail.
 					switch (texture->format->format)
@@ -516,31 +1194,31 @@ void LoadModel()
 					case SDL_PIXELFORMAT_RGB565:
 					case SDL_PIXELFORMAT_RGB888:
 						// RGB format
-						glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB, texture->w, texture->h, 0, GL_RGB, GL_UNSIGNED_BYTE, texture->pixels);
+						StateTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB, texture->w, texture->h, 0, GL_RGB, GL_UNSIGNED_BYTE, texture->pixels);
 						break;
 					case SDL_PIXELFORMAT_RGBA4444:
 					case SDL_PIXELFORMAT_RGBA5551:
 					case SDL_PIXELFORMAT_RGBA8888:
 						// RGBA format
-						glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB_ALPHA, texture->w, texture->h, 0, GL_RGBA, GL_UNSIGNED_BYTE, texture->pixels);
+						StateTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB_ALPHA, texture->w, texture->h, 0, GL_RGBA, GL_UNSIGNED_BYTE, texture->pixels);
 						break;
 					case SDL_PIXELFORMAT_BGR24:
 					case SDL_PIXELFORMAT_BGR555:
 					case SDL_PIXELFORMAT_BGR565:
 					case SDL_PIXELFORMAT_BGR888:
 						// BGR format
-						glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB, texture->w, texture->h, 0, GL_BGR, GL_UNSIGNED_BYTE, texture->pixels);
+						StateTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB, texture->w, texture->h, 0, GL_BGR, GL_UNSIGNED_BYTE, texture->pixels);
 						break;
 					case SDL_PIXELFORMAT_ABGR1555:
 					case SDL_PIXELFORMAT_ABGR4444:
 					case SDL_PIXELFORMAT_ABGR8888:
-						glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB_ALPHA, texture->w, texture->h, 0, GL_RGBA, GL_UNSIGNED_BYTE, texture->pixels);
+						StateTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB_ALPHA, texture->w, texture->h, 0, GL_RGBA, GL_UNSIGNED_BYTE, texture->pixels);
 						break;
 					case SDL_PIXELFORMAT_ARGB1555:
 					case SDL_PIXELFORMAT_ARGB2101010:
 					case SDL_PIXELFORMAT_ARGB4444:
 					case SDL_PIXELFORMAT_ARGB8888:
-						glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB_ALPHA, texture->w, texture->h, 0, GL_RGBA, GL_UNSIGNED_BYTE, texture->pixels);
+						StateTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB_ALPHA, texture->w, texture->h, 0, GL_RGBA, GL_UNSIGNED_BYTE, texture->pixels);
 						break;
 					default:
 						std::cout << "Unknown texture format: " << SDL_GetPixelFormatName(texture->format->format) << std::endl;
@@ -549,6 +1227,18 @@ void LoadModel()
 					
 					// Enable mipmapping
 					glGenerateMipmap(GL_TEXTURE_2D);
+					
+					// Memory for the texture and its mips, at the size and format GL took it as
+					GLint width = 0, height = 0, internalFormat = 0;
+					glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+					glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+					glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+					
+					if (width > 0 && height > 0)
+						AddTextureMemory(materialName.C_Str(), path, width, height, internalFormat, true);
+					
+					// The decoded image is held alongside the scene
+					NoteImportMemory(sceneBytes, (unsigned long long)texture->pitch * texture->h);
 
 					// Set texture parameters.
 					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT); // Repeat wrapping
@@ -557,7 +1247,8 @@ void LoadModel()
 					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR); // trilinear min filtering
 
 					// Unbind the texture
-					glBindTexture(GL_TEXTURE_2D, 0);
+					StateBindTextureUnit(DIFFUSE_TEXTURE_UNIT, GL_TEXTURE_2D, 0);
+					EndStartupPhase();
 
 					std::cout << "Loaded texture: " << path << std::endl;					
 					
@@ -571,6 +1262,11 @@ void LoadModel()
 				texture = nullptr;
 			}
 			
+			// Pick a program for the material
+			material->program = material->hasDiffuseTexture ? texturedProgram : colorProgram;
+			material->indirectProgram = material->hasDiffuseTexture ? texturedIndirectProgram : colorIndirectProgram;
+			material->instancedProgram = material->hasDiffuseTexture ? texturedInstancedProgram : colorInstancedProgram;
+			
 			// Add to model
 			model->materials.push_back(material);
 		}
@@ -579,20 +1275,42 @@ void LoadModel()
 	
 	// Cleanup scene
 	importer.FreeScene();
+	
+	ResetGLStateStats();
+	std::cout << "Model load GL calls:" << std::endl;
+	PrintGLCounters(GetGLStateStats());
 }
 
-void UnloadShader()
+unsigned long long SceneBytes(const Assimp::Importer& importer)
+{
+	if (!importer.GetScene())
+		return 0;
+	
+	aiMemoryInfo memory;
+	importer.GetMemoryRequirements(memory);
+	
+	return memory.total;
+}
+
+void PrintMemoryReport()
 {
-	// Detach and delete vertex shader
-	glDetachShader(shaderProgram, vertexShader);
-	glDeleteShader(vertexShader);
+	// Build the report apart and write it in one go, so the render thread printing at the same time can't see our formatting
+	std::ostringstream report;
+	PrintAssetMemory(report);
 	
-	// Detach and delete fragment shader
-	glDetachShader(shaderProgram, fragmentShader);
-	glDeleteShader(fragmentShader);
+	// Meshes share the pools, which grow by doubling, so some of what they hold is room to grow into
+	unsigned long long used, allocated;
+	GetGeometryPoolBytes(used, allocated);
 	
-	// Delete shader program
-	glDeleteProgram(shaderProgram);	
+	report << "Geometry pools: " << used / 1024.0 << " KB used of " << allocated / 1024.0 << " KB allocated" << std::endl;
+	
+	std::cout << report.str() << std::flush;
+}
+
+void UnloadShader()
+{
+	// Detach and delete shaders and programs
+	UnloadShaderPrograms();
 }
 
 void UnloadModel()
@@ -601,15 +1319,8 @@ void UnloadModel()
 	// Loop through all the meshes
 	for(Mesh* mesh : model->meshes)
 	{
-		// Delete buffers
-		glDeleteBuffers(1, &mesh->indexBuffer);
-		glDeleteBuffers(1, &mesh->vertexBuffer);
-		if(mesh->hasUvs) glDeleteBuffers(1, &mesh->uvBuffer);
-		
-		// Delete vertex array
-		glDeleteVertexArrays(1, &mesh->vertexArrayObject);
-		
-		// Delete the mesh object
+		// Delete the mesh object, its geometry goes with the pool
+		delete mesh->occluder;
 		delete mesh;
 	}
 	
@@ -617,7 +1328,7 @@ void UnloadModel()
 	for(Material* material : model->materials)
 	{
 		// Delete diffuse texture
-		if(material->hasDiffuseTexture) glDeleteTextures(1, &material->diffuseTexture);
+		if(material->hasDiffuseTexture) StateDeleteTextures(1, &material->diffuseTexture);
 		
 		// Delete the material object
 		delete material;
@@ -627,10 +1338,16 @@ void UnloadModel()
 	model->meshes.clear();
 	model->materials.clear();
 	
+	// Delete the shared geometry buffers
+	DestroyGeometryPools();
+	
+	RemoveAssetMemory(modelFile);
+	
 }
 
-void Update(float deltaTime)
+void ProcessEvents()
 {
+	TRACE_SCOPE("ProcessEvents");
 	SDL_Event e;
 		
 	// Poll for events
@@ -642,87 +1359,816 @@ void Update(float deltaTime)
 		// Handle window resize
 		if(e.type == SDL_WINDOWEVENT && e.window.event == SDL_WINDOWEVENT_RESIZED)
 		{
-			// Resize viewport. If the camera projection wasn't been recalculated each frame, you would also need to update the projection matrix here.
+			// Resize viewport, the render thread sets it when the size in the packet changes. If the camera projection wasn't been recalculated each frame, you would also need to update the projection matrix here.
 			displayWidth = e.window.data1;
 			displayHeight = e.window.data2;
-			glViewport(0, 0, displayWidth, displayHeight);
+		}
+		
+		// Print GL state call counts and culling counts using F1, on the render thread as it owns the GL state
+		if(e.type == SDL_KEYDOWN && e.key.keysym.scancode == SDL_SCANCODE_F1)
+			printStats = true;
+		
+		// Switch between sorting by state and front to back using F2
+		if(e.type == SDL_KEYDOWN && e.key.keysym.scancode == SDL_SCANCODE_F2)
+		{
+			drawSortMode = drawSortMode == SORT_BY_STATE ? SORT_FRONT_TO_BACK : SORT_BY_STATE;
+			std::cout << "Draw sort mode: " << (drawSortMode == SORT_BY_STATE ? "by state" : "front to back") << std::endl;
+		}
+		
+		// Switch between multi-draw indirect and one draw call per mesh using F3
+		if(e.type == SDL_KEYDOWN && e.key.keysym.scancode == SDL_SCANCODE_F3 && indirectDrawSupported)
+		{
+			useIndirectDraws = !useIndirectDraws;
+			std::cout << "Multi-draw indirect: " << (useIndirectDraws ? "on" : "off") << std::endl;
+		}
+		
+		// Switch frustum culling on and off using F5
+		if(e.type == SDL_KEYDOWN && e.key.keysym.scancode == SDL_SCANCODE_F5)
+		{
+			frustumCulling = !frustumCulling;
+			std::cout << "Frustum culling: " << (frustumCulling ? "on" : "off") << std::endl;
+		}
+		
+		// Switch the depth pre-pass on and off using F7
+		if(e.type == SDL_KEYDOWN && e.key.keysym.scancode == SDL_SCANCODE_F7)
+		{
+			depthPrePass = !depthPrePass;
+			std::cout << "Depth pre-pass: " << (depthPrePass ? "on" : "off") << std::endl;
+		}
+		
+		// Switch per bucket GPU timings on and off using F8
+		if(e.type == SDL_KEYDOWN && e.key.keysym.scancode == SDL_SCANCODE_F8)
+		{
+			profileBuckets = !profileBuckets;
+			std::cout << "Indirect bucket timings: " << (profileBuckets ? "on" : "off") << std::endl;
+		}
+		
+		// Switch occlusion culling on and off using F6
+		if(e.type == SDL_KEYDOWN && e.key.keysym.scancode == SDL_SCANCODE_F6)
+		{
+			occlusionCulling = !occlusionCulling;
+			std::cout << "Occlusion culling: " << (occlusionCulling ? "on" : "off") << std::endl;
+		}
+		
+		// Print memory per asset using F9. Only loading changes it, so this thread can read it, and the report is written in one go.
+		if(e.type == SDL_KEYDOWN && e.key.keysym.scancode == SDL_SCANCODE_F9)
+			PrintMemoryReport();
+		
+		// Show or hide the instanced grid using F4
+		if(e.type == SDL_KEYDOWN && e.key.keysym.scancode == SDL_SCANCODE_F4)
+		{
+			drawGridInstances = !drawGridInstances;
+			std::cout << "Instanced grid: " << (drawGridInstances ? gridInstances->instances.size() : 0) << " instances" << std::endl;
 		}
 	}
+}
 
+void Simulate(float timestep)
+{
 	// Get the current keystate. This must be called after SDL_PollEvents has finished.
 	const Uint8* keystate = SDL_GetKeyboardState(NULL);
 
 	// Move camera forward using up/w key
 	if (keystate[SDL_SCANCODE_UP] || keystate[SDL_SCANCODE_W])
-		cameraPosition += glm::vec3(0.0f, 0.0f, -5.0f) * deltaTime;
+		cameraPosition += glm::vec3(0.0f, 0.0f, -5.0f) * timestep;
 
 	// Move camera backward using down/s key
 	if (keystate[SDL_SCANCODE_DOWN] || keystate[SDL_SCANCODE_S])
-		cameraPosition += glm::vec3(0.0f, 0.0f, 5.0f) * deltaTime;
+		cameraPosition += glm::vec3(0.0f, 0.0f, 5.0f) * timestep;
 
 	// Rotate model using left/a key
 	if(keystate[SDL_SCANCODE_LEFT] || keystate[SDL_SCANCODE_A])
-		modelRotation += glm::vec3(0.0f, Radians(-45.0f), 0.0f) * deltaTime;
+		modelRotation += glm::vec3(0.0f, Radians(-45.0f), 0.0f) * timestep;
 
 	// Rotate model using right/d key
 	if (keystate[SDL_SCANCODE_RIGHT] || keystate[SDL_SCANCODE_D])
-		modelRotation += glm::vec3(0.0f, Radians(45.0f), 0.0f) * deltaTime;
+		modelRotation += glm::vec3(0.0f, Radians(45.0f), 0.0f) * timestep;
 
 	// Scale model down using left bracket key
 	if (keystate[SDL_SCANCODE_LEFTBRACKET])
-		modelScale += glm::vec3(-0.1f) * deltaTime;
+		modelScale += glm::vec3(-0.1f) * timestep;
 
 	// Scale model up using right bracket key
 	if (keystate[SDL_SCANCODE_RIGHTBRACKET])
-		modelScale += glm::vec3(0.1f) * deltaTime;
+		modelScale += glm::vec3(0.1f) * timestep;
+}
+
+void FollowCameraPath(float t)
+{
+	// Once round the model, moving in and out twice on the way. The camera looks down -z, so turning it by the angle round the y axis keeps it facing the centre.
+	float angle = t * 2.0f * glm::pi<float>();
+	float distance = 5.0f + 2.0f * std::sin(angle * 2.0f);
+	
+	cameraPosition = glm::vec3(std::sin(angle) * distance, 0.0f, std::cos(angle) * distance);
+	cameraRotation = glm::vec3(0.0f, angle, 0.0f);
+}
+
+void RunHeadless()
+{
+	std::cout << "Headless: " << headlessFrameCount << " frames at " << headlessWidth << "x" << headlessHeight << std::endl;
+	headlessStartCounter = SDL_GetPerformanceCounter();
+	
+	// Every frame is one step along the path, whatever the frame rate, so every run draws the same frames
+	for (unsigned int frame = 0; frame < headlessFrameCount; frame++)
+	{
+		TRACE_SCOPE("Frame");
+		
+		frameStartCounter = SDL_GetPerformanceCounter();
+		FollowCameraPath((float)frame / headlessFrameCount);
+		previousState = CaptureSimulationState();
+		
+		// The render thread prints its stats after the last frame
+		printStats = frame + 1 == headlessFrameCount;
+		
+		Update(1.0f);
+		SubmitFramePacket();
+	}
+	
+	quit = true;
+}
+
+void PrintHeadlessTiming()
+{
+	// Include the GPU finishing the last frames
+	glFinish();
+	
+	double seconds = CounterToSeconds(SDL_GetPerformanceCounter() - headlessStartCounter);
+	std::cout << "Headless: " << headlessFrameCount << " frames in " << seconds << " s, " << seconds * 1000.0 / headlessFrameCount << " ms per frame, " << headlessFrameCount / seconds << " fps" << std::endl;
+}
+
+SimulationState CaptureSimulationState()
+{
+	SimulationState state;
+	state.modelPosition = modelPosition;
+	state.modelScale = modelScale;
+	state.modelRotation = modelRotation;
+	state.cameraPosition = cameraPosition;
+	state.cameraRotation = cameraRotation;
+	
+	return state;
+}
+
+SimulationState InterpolateSimulationState(const SimulationState& from, const SimulationState& to, float t)
+{
+	// Steps are small, so blending euler angles directly is fine
+	SimulationState state;
+	state.modelPosition = glm::mix(from.modelPosition, to.modelPosition, t);
+	state.modelScale = glm::mix(from.modelScale, to.modelScale, t);
+	state.modelRotation = glm::mix(from.modelRotation, to.modelRotation, t);
+	state.cameraPosition = glm::mix(from.cameraPosition, to.cameraPosition, t);
+	state.cameraRotation = glm::mix(from.cameraRotation, to.cameraRotation, t);
+	
+	return state;
+}
+
+void Update(float interpolation)
+{
+	TRACE_SCOPE("Update");
+	
+	// Draw part way from the previous step to the current one, so motion is smooth whatever the frame rate
+	renderState = InterpolateSimulationState(previousState, CaptureSimulationState(), interpolation);
 	
 	// Recalculate camera projection matrix. This doesn't really need to be recalculated every frame.
 	cameraProjection = glm::perspective(fieldOfView, (float)displayWidth / (float)displayHeight, zNear, zFar);
 	
 	// Recalculate camera position matrix
-	cameraView = glm::inverse(glm::translate(cameraPosition) * glm::mat4_cast(glm::quat(cameraRotation)) * glm::scale(glm::vec3(1.0f))); // camera has no scaling
+	cameraView = glm::inverse(glm::translate(renderState.cameraPosition) * glm::mat4_cast(glm::quat(renderState.cameraRotation)) * glm::scale(glm::vec3(1.0f))); // camera has no scaling
+	
+	// Combined view projection, so shaders don't have to multiply these per vertex
+	cameraViewProjection = cameraProjection * cameraView;
 	
 	// Recalculate model position matrix
-	modelMatrix = glm::translate(modelPosition) * glm::mat4_cast(glm::quat(modelRotation)) * glm::scale(modelScale);
+	modelMatrix = glm::translate(renderState.modelPosition) * glm::mat4_cast(glm::quat(renderState.modelRotation)) * glm::scale(renderState.modelScale);
+	
+	// Combine model view projection per object, instead of per vertex in the shader
+	MultiplyMatrices(cameraViewProjection, &modelMatrix, &modelViewProjection, 1);
+	
+	// World space frustum planes, and world space boxes for every mesh
+	cameraFrustum = ExtractFrustum(cameraViewProjection);
+	meshBoxes.Clear();
+	
+	// The model's sphere is a cheap first test, if it is outside so is every mesh and no box needs testing
+	glm::vec3 sphereCenter;
+	float sphereRadius;
+	TransformSphere(model->bounds, modelMatrix, sphereCenter, sphereRadius);
+	
+	if (frustumCulling && !SphereInFrustum(cameraFrustum, sphereCenter, sphereRadius))
+	{
+		meshVisible.assign(model->meshes.size(), 0);
+		drawnMeshCount = 0;
+	}
+	else
+	{
+		for (Mesh* mesh : model->meshes)
+		{
+			glm::vec3 center, extent;
+			TransformBounds(mesh->bounds, modelMatrix, center, extent);
+			meshBoxes.Add(center, extent);
+		}
+		
+		// Test the boxes four at a time
+		if (frustumCulling)
+		{
+			TRACE_SCOPE("Frustum culling");
+			drawnMeshCount = CullBoxes(cameraFrustum, meshBoxes, meshVisible);
+		}
+		else
+		{
+			meshVisible.assign(model->meshes.size(), 1);
+			drawnMeshCount = model->meshes.size();
+		}
+	}
+	
+	culledMeshCount = model->meshes.size() - drawnMeshCount;
+	
+	// Draw the visible occluders into the software depth buffer, then drop the meshes hidden behind them
+	occludedMeshCount = 0;
+	
+	if (occlusionCulling)
+	{
+		TRACE_SCOPE("Occlusion culling");
+		BeginOcclusionFrame(cameraViewProjection);
+		
+		for (unsigned int i = 0; i < model->meshes.size(); i++)
+		{
+			if (meshVisible[i] && model->meshes[i]->occluder != nullptr)
+				AddOccluder(model->meshes[i]->occluder, modelMatrix);
+		}
+		
+		RasterizeOccluders();
+		occludedMeshCount = CullOccludedBoxes(meshBoxes, meshVisible);
+		drawnMeshCount -= occludedMeshCount;
+	}
+	
+	// Each grid instance draws every mesh, so its copies count towards the mesh totals
+	if (drawGridInstances)
+		CullGridInstances();
+	
+	// Everything the render thread needs for this frame
+	BuildFramePacket(BeginFramePacket());
+}
+
+void BuildFramePacket(FramePacket& packet)
+{
+	TRACE_SCOPE("BuildFramePacket");
+	
+	packet.cameraView = cameraView;
+	packet.cameraProjection = cameraProjection;
+	packet.cameraViewProjection = cameraViewProjection;
+	packet.cameraPosition = renderState.cameraPosition;
+	packet.modelMatrix = modelMatrix;
+	packet.modelViewProjection = modelViewProjection;
+	
+	packet.displayWidth = displayWidth;
+	packet.displayHeight = displayHeight;
+	packet.useIndirectDraws = useIndirectDraws;
+	packet.drawGridInstances = drawGridInstances;
+	packet.depthPrePass = depthPrePass;
+	packet.profileBuckets = profileBuckets;
+	
+	packet.printStats = printStats;
+	packet.drawnMeshCount = drawnMeshCount;
+	packet.culledMeshCount = culledMeshCount;
+	packet.occludedMeshCount = occludedMeshCount;
+	printStats = false;
+	
+	if (packet.drawGridInstances)
+		packet.gridVisible.assign(gridVisible.begin(), gridVisible.end());
+	
+	// Build the draw list from the meshes that passed culling. Every mesh gets a key packing its program, material, texture, vertex array and depth.
+	packet.drawList.clear();
+	packet.depthDrawList.clear();
+	
+	glm::mat4 modelView = cameraView * modelMatrix;
+	
+	for(unsigned int i = 0; i < model->meshes.size(); i++)
+	{
+		if (!meshVisible[i])
+			continue;
+		
+		Mesh* mesh = model->meshes[i];
+		Material* material = model->materials[mesh->materialIndex];
+		
+		// View space depth of the mesh centre, the camera looks down -z
+		float depth = -(modelView * glm::vec4(mesh->bounds.sphereCenter, 1.0f)).z;
+		
+		DrawItem item;
+		item.key = MakeDrawKey(drawSortMode, material->program->id, mesh->materialIndex, material->hasDiffuseTexture ? material->diffuseTexture : 0, mesh->geometry.format, DepthBucket(depth, zNear, zFar));
+		item.index = i;
+		packet.drawList.push_back(item);
+		
+		// The pre-pass uses one program for everything, so only depth and vertex array go in its key
+		if (depthPrePass)
+		{
+			item.key = MakeDrawKey(SORT_FRONT_TO_BACK, 0, 0, 0, mesh->geometry.format, DepthBucket(depth, zNear, zFar));
+			packet.depthDrawList.push_back(item);
+		}
+	}
+	
+	// Sort so draws sharing state are next to each other
+	SortDrawList(packet.drawList, drawListScratch);
+	SortDrawList(packet.depthDrawList, drawListScratch);
+}
+
+FramePacket& BeginFramePacket()
+{
+	TRACE_SCOPE("Wait for render thread");
+	Uint64 waitStart = SDL_GetPerformanceCounter();
+	
+	// The render thread takes a packet before drawing it, so once nothing is pending the other packet is free
+	std::unique_lock<std::mutex> lock(framePacketMutex);
+	framePacketTaken.wait(lock, [] { return framePacketPending == -1; });
+	
+	framePacketWaitCounter = SDL_GetPerformanceCounter() - waitStart;
+	
+	return framePackets[framePacketWrite];
+}
+
+void SubmitFramePacket()
+{
+	// The main thread's share of the frame, from the top of the loop to here without the wait for a packet
+	framePackets[framePacketWrite].mainMilliseconds = CounterToSeconds(SDL_GetPerformanceCounter() - frameStartCounter - framePacketWaitCounter) * 1000.0;
+	framePacketWaitCounter = 0;
+	
+	// Without a render thread, draw it now
+	if (!USE_RENDER_THREAD)
+	{
+		DrawFramePacket(framePackets[framePacketWrite]);
+		framePacketWrite = 1 - framePacketWrite;
+		return;
+	}
+	
+	{
+		std::lock_guard<std::mutex> lock(framePacketMutex);
+		framePacketPending = framePacketWrite;
+	}
+	
+	framePacketSubmitted.notify_one();
+	framePacketWrite = 1 - framePacketWrite;
+}
+
+void StartRenderThread()
+{
+	// The viewport was set to the display size when the context was made
+	viewportWidth = displayWidth;
+	viewportHeight = displayHeight;
+	
+	if (!USE_RENDER_THREAD)
+		return;
+	
+	// A context can only be current on one thread at a time
+	MakeContextCurrent(false);
+	renderThreadQuit = false;
+	renderThread = std::thread(RenderThread);
+}
+
+void StopRenderThread()
+{
+	if (!USE_RENDER_THREAD)
+		return;
+	
+	{
+		std::lock_guard<std::mutex> lock(framePacketMutex);
+		renderThreadQuit = true;
+	}
+	
+	framePacketSubmitted.notify_one();
+	renderThread.join();
+	
+	MakeContextCurrent(true);
 }
 
-void Render()
+void ReportStartupTimeline()
 {
+	if (startupReported)
+		return;
+	
+	startupReported = true;
+	
+	// Where the startup time went
+	FinishStartupTimeline();
+	PrintStartupTimeline();
+	
+	if (!startupFile.empty() && !WriteStartupTimeline(startupFile))
+		std::cout << "Error writing startup timeline: " << startupFile << std::endl;
+}
+
+void RenderThread()
+{
+	SetTraceThreadName("Render");
+	MakeContextCurrent(true);
+	
+	while (true)
+	{
+		// Wait for the next packet, or to be told to stop
+		int index;
+		
+		{
+			std::unique_lock<std::mutex> lock(framePacketMutex);
+			framePacketSubmitted.wait(lock, [] { return renderThreadQuit || framePacketPending != -1; });
+			
+			if (framePacketPending == -1)
+				break;
+			
+			index = framePacketPending;
+			framePacketPending = -1;
+		}
+		
+		// The main thread can start filling the other packet now
+		framePacketTaken.notify_one();
+		
+		DrawFramePacket(framePackets[index]);
+	}
+	
+	// Release the context, so the main thread can clean up
+	MakeContextCurrent(false);
+}
+
+void DrawFramePacket(const FramePacket& packet)
+{
+	if (packet.displayWidth != viewportWidth || packet.displayHeight != viewportHeight)
+	{
+		viewportWidth = packet.displayWidth;
+		viewportHeight = packet.displayHeight;
+		glViewport(0, 0, viewportWidth, viewportHeight);
+	}
+	
+	Render(packet);
+}
+
+void Render(const FramePacket& packet)
+{
+	TRACE_SCOPE("Render");
+	Uint64 renderStart = SDL_GetPerformanceCounter();
+	
+	// Start counting GL state calls for this frame
+	ResetGLStateStats();
+	
+	// Collect the pass timings from a few frames ago and start timing this one
+	BeginProfilerFrame();
+	BeginPass("Frame");
+	
+	// The collected frame's GPU time
+	double gpuMilliseconds;
+	
+	if (GetCollectedFrameTime(gpuMilliseconds))
+		AddFrameSample(FRAME_METRIC_GPU, gpuMilliseconds);
+	
 	// Clear color and depth buffers
+	BeginPass("Clear");
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	EndPass();
 	
-	// Use shader
-	glUseProgram(shaderProgram);
+	// Move to the next region of the ring buffer, only waits if the GPU is still reading it
+	BeginPass("Upload");
+	Uint64 ringWaitStart = SDL_GetPerformanceCounter();
 	
-	// Update uniform variables
-	glUniformMatrix4fv(modelMatUniform, 1, false, &modelMatrix[0][0]);
-	glUniformMatrix4fv(cameraViewMatUniform, 1, false, &cameraView[0][0]);
-	glUniformMatrix4fv(cameraProjMatUniform, 1, false, &cameraProjection[0][0]);
+	{
+		TRACE_SCOPE("Wait for ring buffer");
+		BeginRingFrame();
+	}
 	
-	// Draw
-	for(Mesh* mesh : model->meshes)
+	// Time blocked on the GPU, which isn't CPU work
+	Uint64 ringWaitCounter = SDL_GetPerformanceCounter() - ringWaitStart;
+	
+	// Write the camera block once per frame, shared by every program through the fixed binding point
+	RingAllocation cameraAllocation = AllocateRing(sizeof(CameraBlock), uniformBufferAlignment);
+	CameraBlock* camera = (CameraBlock*)cameraAllocation.data;
+	camera->view = packet.cameraView;
+	camera->projection = packet.cameraProjection;
+	camera->viewProjection = packet.cameraViewProjection;
+	camera->position = glm::vec4(packet.cameraPosition, 1.0f);
+	
+	StateBindBufferRange(GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, GetRingBuffer(), cameraAllocation.offset, sizeof(CameraBlock));
+	
+	// Write the indirect commands for the packet's sorted draw list, falling back to one call per mesh if they don't fit
+	bool indirect = packet.useIndirectDraws && BuildIndirectDraws(packet);
+	
+	// Everything for this frame has been written, make it visible before drawing
+	FlushRingFrame();
+	EndPass();
+	
+	// The opaque passes are timed as a whole separately with and without the pre-pass, so each scene can pick the faster one
+	BeginPass(packet.depthPrePass ? "Opaque with depth pre-pass" : "Opaque without depth pre-pass");
+	
+	if (packet.depthPrePass)
+	{
+		// Depth only, nearest first, with color writes off
+		BeginPass("Depth pre-pass");
+		StateColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		
+		if (indirect)
+			DrawIndirect(depthIndirectBuckets, packet.profileBuckets);
+		else
+			DrawDepthLoop(packet);
+		
+		StateColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		EndPass();
+		
+		// Depth is already final, so only shade the fragments that won it
+		StateDepthFunc(GL_EQUAL);
+		StateDepthMask(GL_FALSE);
+	}
+	
+	// Submit, in key order
+	BeginPass("Main pass");
+	
+	if (indirect)
+		DrawIndirect(indirectBuckets, packet.profileBuckets);
+	else
+		DrawLoop(packet);
+	
+	EndPass();
+	
+	// Back to normal depth testing for everything else
+	if (packet.depthPrePass)
+	{
+		StateDepthFunc(GL_LEQUAL);
+		StateDepthMask(GL_TRUE);
+	}
+	
+	EndPass();
+	
+	// Copies of the model, one draw call per mesh however many there are
+	if (packet.drawGridInstances)
+	{
+		BeginPass("Instanced grid");
+		DrawModelInstances(model, gridInstances, packet.gridVisible);
+		EndPass();
+	}
+	
+	// Fence this frame's region of the ring buffer
+	EndRingFrame();
+	
+	// Stop timing before the limiter waits
+	EndPass();
+	EndProfilerFrame();
+	
+	// The CPU bound on the frame rate is whichever thread took longer, without the ring buffer wait
+	double renderMilliseconds = CounterToSeconds(SDL_GetPerformanceCounter() - renderStart - ringWaitCounter) * 1000.0;
+	AddFrameSample(FRAME_METRIC_CPU, std::max(packet.mainMilliseconds, renderMilliseconds));
+	
+	// Swap buffers, when the limiter says the frame is due
+	{
+		TRACE_SCOPE("LimitFrameRate");
+		LimitFrameRate();
+	}
+	
+	{
+		TRACE_SCOPE("SwapWindow");
+		
+		// Nothing to show headless, just make sure the frame's commands are on their way
+		if (headless)
+			glFlush();
+		else
+			SDL_GL_SwapWindow(window);
+	}
+	
+	RecordPresent();
+	UpdateFrameStatsOutput();
+	
+	// The first present ends startup
+	ReportStartupTimeline();
+	
+	// Stats asked for with F1
+	if (packet.printStats)
+	{
+		const GLStateStats& stats = GetGLStateStats();
+		std::cout << "GL state calls: " << stats.issued << " issued, " << stats.suppressed << " suppressed" << std::endl;
+		PrintGLCounters(stats);
+		std::cout << "Meshes: " << packet.drawnMeshCount << " drawn, " << packet.culledMeshCount << " culled, " << packet.occludedMeshCount << " occluded" << std::endl;
+		
+		// Present intervals since the last print
+		PrintFramePacing();
+		presentIntervals.Reset();
+		
+		// Average CPU and GPU time per pass since the last print
+		PrintPassTimings();
+		ResetPassTimings();
+		
+		// Distribution of frame times over the window
+		PrintFrameStats();
+	}
+}
+
+void DrawLoop(const FramePacket& packet)
+{
+	// Currently bound program and material
+	ShaderProgram* currentProgram = nullptr;
+	Material* currentMaterial = nullptr;
+	
+	// Draw, in key order
+	for(const DrawItem& item : packet.drawList)
 	{
+		Mesh* mesh = model->meshes[item.index];
+		
 		// Get material to draw with
 		Material* material = model->materials[mesh->materialIndex];
 		
-		// Update material uniforms
-		glUniform3fv(diffuseColorUniform, 1, &material->diffuseColor[0]);
-		glUniform1i(hasDiffuseTextureUniform, material->hasDiffuseTexture);
+		// Switch program only when it changes, draws are grouped so this happens once per program
+		if(material->program != currentProgram)
+		{
+			currentProgram = material->program;
+			UseShaderProgram(currentProgram);
+			
+			// Update uniform variables, these belong to the program so need setting for each one
+			StateUniformMatrix4fv(currentProgram->modelViewProjectionUniform, 1, false, &packet.modelViewProjection[0][0]);
+			
+			// Only upload the separate model matrix if the shader uses it
+			if (currentProgram->modelUniform != -1)
+				StateUniformMatrix4fv(currentProgram->modelUniform, 1, false, &packet.modelMatrix[0][0]);
+			
+			// Material uniforms need setting again for the new program
+			currentMaterial = nullptr;
+		}
 		
-		// Use texture if material has diffuse texture
-		if(material->hasDiffuseTexture)
+		// Update material uniforms when the material changes
+		if(material != currentMaterial)
 		{
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, material->diffuseTexture);
-			glUniform1i(diffuseTextureUniform, 0);
+			currentMaterial = material;
+			
+			if (currentProgram->diffuseColorUniform != -1)
+				StateUniform3fv(currentProgram->diffuseColorUniform, 1, &material->diffuseColor[0]);
+			
+			// Use texture if material has diffuse texture
+			if(material->hasDiffuseTexture)
+			{
+				StateBindTextureUnit(DIFFUSE_TEXTURE_UNIT, GL_TEXTURE_2D, material->diffuseTexture);
+			}
 		}
 		
-		// Draw
-		glBindVertexArray(mesh->vertexArrayObject);
-		glDrawElements(GL_TRIANGLES, mesh->drawCount, GL_UNSIGNED_INT, 0);
+		// Draw. Meshes with the same vertex format share a vertex array, so this rarely changes.
+		StateBindVertexArray(GetGeometryVertexArray(mesh->geometry.format));
+		DrawGeometry(mesh->geometry);
+		
+	}
+}
+
+bool BuildIndirectDraws(const FramePacket& packet)
+{
+	TRACE_SCOPE("BuildIndirectDraws");
+	
+	BeginIndirectDraws();
+	indirectBuckets.clear();
+	depthIndirectBuckets.clear();
+	unsigned int commandCount = 0;
+	
+	// Pre-pass commands first, then the main pass
+	if (packet.depthPrePass)
+		AddIndirectBuckets(packet, packet.depthDrawList, true, depthIndirectBuckets, commandCount);
+	
+	AddIndirectBuckets(packet, packet.drawList, false, indirectBuckets, commandCount);
+	
+	// One write for every command and its data
+	return UploadIndirectDraws();
+}
+
+void AddIndirectBuckets(const FramePacket& packet, const std::vector<DrawItem>& drawList, bool depthOnly, std::vector<IndirectBucket>& buckets, unsigned int& commandCount)
+{
+	// Turn the sorted list into commands, starting a new bucket whenever the program, texture or vertex array changes. Material colors go in the per draw data, so they don't split buckets.
+	for(const DrawItem& item : drawList)
+	{
+		Mesh* mesh = model->meshes[item.index];
+		Material* material = model->materials[mesh->materialIndex];
+		
+		// Depth only draws all share one program and need no texture
+		ShaderProgram* program = depthOnly ? depthIndirectProgram : material->indirectProgram;
+		GLuint texture = !depthOnly && material->hasDiffuseTexture ? material->diffuseTexture : 0;
+		
+		if (buckets.empty() || buckets.back().program != program || buckets.back().texture != texture || buckets.back().format != mesh->geometry.format)
+		{
+			IndirectBucket bucket;
+			bucket.program = program;
+			bucket.texture = texture;
+			bucket.format = mesh->geometry.format;
+			bucket.firstCommand = commandCount;
+			bucket.commandCount = 0;
+			buckets.push_back(bucket);
+		}
+		
+		// Per draw data, read through baseInstance
+		InstanceData data;
+		data.matrix = packet.modelViewProjection;
+		data.color = glm::vec4(material->diffuseColor, 1.0f);
+		
+		AddIndirectDraw(mesh->geometry, data);
+		buckets.back().commandCount++;
+		commandCount++;
+	}
+}
+
+void DrawIndirect(const std::vector<IndirectBucket>& buckets, bool profile)
+{
+	// One call per bucket
+	for(unsigned int i = 0; i < buckets.size(); i++)
+	{
+		const IndirectBucket& bucket = buckets[i];
+		
+		// Named by position and program, so the same bucket lines up from frame to frame while the scene doesn't change
+		if (profile)
+			BeginPass("Bucket " + std::to_string(i) + " " + bucket.program->name);
 		
+		UseShaderProgram(bucket.program);
+		
+		if (bucket.texture != 0)
+			StateBindTextureUnit(DIFFUSE_TEXTURE_UNIT, GL_TEXTURE_2D, bucket.texture);
+		
+		SubmitIndirectDraws(bucket.format, bucket.firstCommand, bucket.commandCount);
+		
+		if (profile)
+			EndPass();
+	}
+}
+
+void DrawDepthLoop(const FramePacket& packet)
+{
+	// One program and one matrix for the whole pass
+	UseShaderProgram(depthProgram);
+	StateUniformMatrix4fv(depthProgram->modelViewProjectionUniform, 1, false, &packet.modelViewProjection[0][0]);
+	
+	// Nearest first
+	for(const DrawItem& item : packet.depthDrawList)
+	{
+		Mesh* mesh = model->meshes[item.index];
+		StateBindVertexArray(GetGeometryVertexArray(mesh->geometry.format));
+		DrawGeometry(mesh->geometry);
+	}
+}
+
+void CreateGridInstances()
+{
+	std::vector<glm::mat4> transforms;
+	std::vector<glm::vec4> colors;
+	
+	// Lay the grid out on the ground in front of the camera, fading from red to blue along x and z
+	for (unsigned int z = 0; z < INSTANCE_GRID_SIZE; z++)
+	{
+		for (unsigned int x = 0; x < INSTANCE_GRID_SIZE; x++)
+		{
+			float u = (float)x / (INSTANCE_GRID_SIZE - 1);
+			float v = (float)z / (INSTANCE_GRID_SIZE - 1);
+			
+			glm::vec3 position((u - 0.5f) * INSTANCE_GRID_SIZE * INSTANCE_GRID_SPACING, -4.0f, -v * INSTANCE_GRID_SIZE * INSTANCE_GRID_SPACING);
+			transforms.push_back(glm::translate(position));
+			colors.push_back(glm::vec4(SRGBToLinear(glm::vec3(1.0f - u, 0.5f, v)), 1.0f));
+		}
 	}
 	
-	// Swap buffers
-	SDL_GL_SwapWindow(window);
+	gridInstances = CreateInstanceBuffer(transforms.size(), transforms.data(), colors.data());
+}
+
+void CullGridInstances()
+{
+	TRACE_SCOPE("Grid culling");
+	unsigned int count = gridInstances->instances.size();
+	unsigned int visibleCount = count;
+	
+	// The model's box moved by each instance's transform
+	gridBoxes.Clear();
+	
+	for (const InstanceData& instance : gridInstances->instances)
+	{
+		glm::vec3 center, extent;
+		TransformBounds(model->bounds, instance.matrix, center, extent);
+		gridBoxes.Add(center, extent);
+	}
+	
+	// Four instances at a time, like the meshes
+	if (frustumCulling)
+		visibleCount = CullBoxes(cameraFrustum, gridBoxes, gridInstanceVisible);
+	else
+		gridInstanceVisible.assign(count, 1);
+	
+	gridVisible.clear();
+	
+	for (unsigned int i = 0; i < count; i++)
+	{
+		if (gridInstanceVisible[i])
+			gridVisible.push_back(i);
+	}
+	
+	drawnMeshCount += visibleCount * model->meshes.size();
+	culledMeshCount += (count - visibleCount) * model->meshes.size();
+}
+
+void DrawModelInstances(Model* model, InstanceBuffer* instances, const std::vector<unsigned int>& visible)
+{
+	// Pack the visible instances, only copying what changed since last frame
+	UploadInstances(instances, visible);
+	
+	for (Mesh* mesh : model->meshes)
+	{
+		Material* material = model->materials[mesh->materialIndex];
+		
+		// The camera block supplies the view projection, so only material uniforms are needed
+		UseShaderProgram(material->instancedProgram);
+		
+		if (material->instancedProgram->diffuseColorUniform != -1)
+			StateUniform3fv(material->instancedProgram->diffuseColorUniform, 1, &material->diffuseColor[0]);
+		
+		if (material->hasDiffuseTexture)
+			StateBindTextureUnit(DIFFUSE_TEXTURE_UNIT, GL_TEXTURE_2D, material->diffuseTexture);
+		
+		DrawInstances(instances, mesh->geometry);
+	}
 }
\ No newline at end of file
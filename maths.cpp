@@ -0,0 +1,49 @@
+#include "maths.h"
+
+// Use SSE if the compiler targets it (always the case on x64)
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define MATHS_SSE
+#include <xmmintrin.h>
+#endif
+
+static float SRGBToLinear(float value)
+{
+	// Piecewise sRGB transfer function
+	return value <= 0.04045f ? value / 12.92f : glm::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+glm::vec3 SRGBToLinear(const glm::vec3& color)
+{
+	return glm::vec3(SRGBToLinear(color.r), SRGBToLinear(color.g), SRGBToLinear(color.b));
+}
+
+void MultiplyMatrices(const glm::mat4& left, const glm::mat4* right, glm::mat4* out, unsigned int count)
+{
+#ifdef MATHS_SSE
+	// Load the columns of the left matrix once for the whole batch. glm matrices aren't guaranteed to be 16 byte aligned, so use unaligned loads.
+	__m128 column0 = _mm_loadu_ps(&left[0][0]);
+	__m128 column1 = _mm_loadu_ps(&left[1][0]);
+	__m128 column2 = _mm_loadu_ps(&left[2][0]);
+	__m128 column3 = _mm_loadu_ps(&left[3][0]);
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		// Each output column is the left matrix's columns weighted by the matching right column
+		for (unsigned int j = 0; j < 4; j++)
+		{
+			const float* r = &right[i][j][0];
+
+			__m128 result = _mm_mul_ps(column0, _mm_set1_ps(r[0]));
+			result = _mm_add_ps(result, _mm_mul_ps(column1, _mm_set1_ps(r[1])));
+			result = _mm_add_ps(result, _mm_mul_ps(column2, _mm_set1_ps(r[2])));
+			result = _mm_add_ps(result, _mm_mul_ps(column3, _mm_set1_ps(r[3])));
+
+			_mm_storeu_ps(&out[i][j][0], result);
+		}
+	}
+#else
+	// Scalar fallback
+	for (unsigned int i = 0; i < count; i++)
+		out[i] = left * right[i];
+#endif
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#define GLM_FORCE_RADIANS
+#include <GLM/glm.hpp>
+
+// Convert an sRGB encoded color to linear, as the GPU does when sampling an sRGB texture
+glm::vec3 SRGBToLinear(const glm::vec3& color);
+
+// Multiply one matrix by a batch of matrices, out[i] = left * right[i]. Uses SSE when available, so
+// the left matrix is loaded once and each product is 16 multiply-adds on 4 wide registers.
+void MultiplyMatrices(const glm::mat4& left, const glm::mat4* right, glm::mat4* out, unsigned int count);
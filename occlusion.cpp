@@ -0,0 +1,481 @@
+#include "occlusion.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "trace.h"
+
+// Use SSE if the compiler targets it (always the case on x64)
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define OCCLUSION_SSE
+#include <xmmintrin.h>
+#endif
+
+// Struct to hold a triangle set up for rasterizing, in occlusion buffer pixels with depth from 0 to 1
+struct ScreenTriangle
+{
+	float edgeA[3], edgeB[3], edgeC[3]; // edge functions, A * x + B * y + C >= 0 inside
+	float depthA, depthB, depthC; // depth plane, A * x + B * y + C
+	int minX, maxX, minY, maxY; // pixel bounds, clamped to the buffer
+};
+
+// Struct to hold one queued occluder
+struct QueuedOccluder
+{
+	const Occluder* occluder;
+	glm::mat4 modelViewProjection;
+};
+
+// Camera and queue for this frame
+static glm::mat4 occlusionViewProjection;
+static std::vector<QueuedOccluder> occluderQueue;
+static std::vector<ScreenTriangle> screenTriangles;
+static std::vector<glm::vec4> clipVertices;
+
+// Depth pyramid, level 0 is the rasterized buffer
+struct DepthLevel
+{
+	unsigned int width, height;
+	std::vector<float> minimum, maximum;
+};
+
+static std::vector<DepthLevel> depthLevels;
+
+// Worker threads, each rasterizes one band of rows. The calling thread always does band 0.
+static std::vector<std::thread> workers;
+static std::mutex workMutex;
+static std::condition_variable workStart;
+static std::condition_variable workDone;
+static unsigned int workGeneration = 0;
+static unsigned int workRemaining = 0;
+static bool workQuit = false;
+
+// Rasterize every triangle into rows [startY, endY). Bands never overlap, so no locking is needed.
+static void RasterizeBand(int startY, int endY)
+{
+	float* depth = depthLevels[0].minimum.data();
+
+	for (const ScreenTriangle& triangle : screenTriangles)
+	{
+		int minY = std::max(triangle.minY, startY);
+		int maxY = std::min(triangle.maxY, endY - 1);
+
+		// Start on a multiple of four, the buffer width is one too so the last group never runs off the row
+		int minX = triangle.minX & ~3;
+
+		for (int y = minY; y <= maxY; y++)
+		{
+			float pixelY = y + 0.5f;
+			float* row = depth + y * OCCLUSION_WIDTH;
+			int x = minX;
+
+#ifdef OCCLUSION_SSE
+			// Step across the row four pixels at a time
+			__m128 stepX = _mm_set1_ps(4.0f);
+			__m128 pixelX = _mm_add_ps(_mm_set1_ps((float)x), _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f));
+			__m128 edge[3];
+			__m128 edgeStep[3];
+
+			for (unsigned int e = 0; e < 3; e++)
+			{
+				edge[e] = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.edgeA[e]), pixelX), _mm_set1_ps(triangle.edgeB[e] * pixelY + triangle.edgeC[e]));
+				edgeStep[e] = _mm_mul_ps(_mm_set1_ps(triangle.edgeA[e]), stepX);
+			}
+
+			__m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.depthA), pixelX), _mm_set1_ps(triangle.depthB * pixelY + triangle.depthC));
+			__m128 zStep = _mm_mul_ps(_mm_set1_ps(triangle.depthA), stepX);
+			__m128 zero = _mm_setzero_ps();
+
+			for (; x <= triangle.maxX; x += 4)
+			{
+				// Inside all three edges
+				__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(edge[0], zero), _mm_cmpge_ps(edge[1], zero)), _mm_cmpge_ps(edge[2], zero));
+
+				if (_mm_movemask_ps(inside) != 0)
+				{
+					// Keep the nearest depth, only where the pixel is covered
+					__m128 current = _mm_loadu_ps(row + x);
+					__m128 nearest = _mm_min_ps(current, z);
+					_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, current)));
+				}
+
+				for (unsigned int e = 0; e < 3; e++)
+					edge[e] = _mm_add_ps(edge[e], edgeStep[e]);
+
+				z = _mm_add_ps(z, zStep);
+			}
+#else
+			// Scalar fallback
+			for (x = triangle.minX; x <= triangle.maxX; x++)
+			{
+				float pixelX = x + 0.5f;
+				bool inside = true;
+
+				for (unsigned int e = 0; e < 3; e++)
+					inside = inside && triangle.edgeA[e] * pixelX + triangle.edgeB[e] * pixelY + triangle.edgeC[e] >= 0.0f;
+
+				if (inside)
+					row[x] = std::min(row[x], triangle.depthA * pixelX + triangle.depthB * pixelY + triangle.depthC);
+			}
+#endif
+		}
+	}
+}
+
+// Rows for a band, spreading the buffer evenly over the calling thread and the workers
+static void BandRows(unsigned int band, int& startY, int& endY)
+{
+	unsigned int bandCount = workers.size() + 1;
+	startY = band * OCCLUSION_HEIGHT / bandCount;
+	endY = (band + 1) * OCCLUSION_HEIGHT / bandCount;
+}
+
+static void WorkerThread(unsigned int band)
+{
+	SetTraceThreadName("Occlusion " + std::to_string(band));
+	unsigned int generation = 0;
+
+	while (true)
+	{
+		// Wait for the next frame's triangles
+		{
+			std::unique_lock<std::mutex> lock(workMutex);
+			workStart.wait(lock, [&] { return workQuit || workGeneration != generation; });
+
+			if (workQuit)
+				return;
+
+			generation = workGeneration;
+		}
+
+		{
+			TRACE_SCOPE("RasterizeBand");
+			int startY, endY;
+			BandRows(band, startY, endY);
+			RasterizeBand(startY, endY);
+		}
+
+		// Tell the calling thread this band is done
+		std::lock_guard<std::mutex> lock(workMutex);
+
+		if (--workRemaining == 0)
+			workDone.notify_one();
+	}
+}
+
+void InitialiseOcclusion(unsigned int threadCount)
+{
+	// Allocate every pyramid level once, halving down to 1 x 1
+	unsigned int width = OCCLUSION_WIDTH;
+	unsigned int height = OCCLUSION_HEIGHT;
+
+	while (true)
+	{
+		DepthLevel level;
+		level.width = width;
+		level.height = height;
+		level.minimum.assign(width * height, 1.0f);
+		level.maximum.assign(width * height, 1.0f);
+		depthLevels.push_back(level);
+
+		if (width == 1 && height == 1)
+			break;
+
+		width = std::max(width / 2, 1u);
+		height = std::max(height / 2, 1u);
+	}
+
+	// Never more bands than rows
+	threadCount = std::min(threadCount, OCCLUSION_HEIGHT - 1);
+
+	for (unsigned int i = 0; i < threadCount; i++)
+		workers.push_back(std::thread(WorkerThread, i + 1));
+}
+
+void ShutdownOcclusion()
+{
+	{
+		std::lock_guard<std::mutex> lock(workMutex);
+		workQuit = true;
+	}
+
+	workStart.notify_all();
+
+	for (std::thread& worker : workers)
+		worker.join();
+
+	workers.clear();
+	depthLevels.clear();
+	workQuit = false;
+}
+
+void BeginOcclusionFrame(const glm::mat4& viewProjection)
+{
+	occlusionViewProjection = viewProjection;
+	occluderQueue.clear();
+}
+
+void AddOccluder(const Occluder* occluder, const glm::mat4& model)
+{
+	QueuedOccluder queued;
+	queued.occluder = occluder;
+	MultiplyMatrices(occlusionViewProjection, &model, &queued.modelViewProjection, 1);
+	occluderQueue.push_back(queued);
+}
+
+// Transform every queued occluder and set up its front facing triangles
+static void SetupTriangles()
+{
+	screenTriangles.clear();
+
+	for (const QueuedOccluder& queued : occluderQueue)
+	{
+		const Occluder* occluder = queued.occluder;
+
+		clipVertices.resize(occluder->vertices.size());
+
+		for (unsigned int i = 0; i < occluder->vertices.size(); i++)
+			clipVertices[i] = queued.modelViewProjection * glm::vec4(occluder->vertices[i], 1.0f);
+
+		for (unsigned int i = 0; i + 2 < occluder->indices.size(); i += 3)
+		{
+			const glm::vec4* clip[3] = { &clipVertices[occluder->indices[i]], &clipVertices[occluder->indices[i + 1]], &clipVertices[occluder->indices[i + 2]] };
+
+			// Triangles crossing the near plane are dropped rather than clipped. Missing an occluder only makes culling less effective, never wrong.
+			if (clip[0]->w <= 1e-5f || clip[1]->w <= 1e-5f || clip[2]->w <= 1e-5f)
+				continue;
+
+			if (clip[0]->z < -clip[0]->w || clip[1]->z < -clip[1]->w || clip[2]->z < -clip[2]->w)
+				continue;
+
+			// To occlusion buffer pixels, with y up as in normalised device coordinates
+			glm::vec3 screen[3];
+
+			for (unsigned int v = 0; v < 3; v++)
+			{
+				glm::vec3 ndc = glm::vec3(*clip[v]) / clip[v]->w;
+				screen[v] = glm::vec3((ndc.x * 0.5f + 0.5f) * OCCLUSION_WIDTH, (ndc.y * 0.5f + 0.5f) * OCCLUSION_HEIGHT, ndc.z * 0.5f + 0.5f);
+			}
+
+			// Counter-clockwise triangles have positive area, anything else faces away or is degenerate
+			glm::vec2 ab(screen[1].x - screen[0].x, screen[1].y - screen[0].y);
+			glm::vec2 ac(screen[2].x - screen[0].x, screen[2].y - screen[0].y);
+			float area = ab.x * ac.y - ac.x * ab.y;
+
+			if (area <= 0.0f)
+				continue;
+
+			ScreenTriangle triangle;
+
+			float minX = std::min(std::min(screen[0].x, screen[1].x), screen[2].x);
+			float maxX = std::max(std::max(screen[0].x, screen[1].x), screen[2].x);
+			float minY = std::min(std::min(screen[0].y, screen[1].y), screen[2].y);
+			float maxY = std::max(std::max(screen[0].y, screen[1].y), screen[2].y);
+
+			triangle.minX = std::max((int)std::floor(minX), 0);
+			triangle.maxX = std::min((int)std::ceil(maxX), (int)OCCLUSION_WIDTH - 1);
+			triangle.minY = std::max((int)std::floor(minY), 0);
+			triangle.maxY = std::min((int)std::ceil(maxY), (int)OCCLUSION_HEIGHT - 1);
+
+			if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+				continue;
+
+			// Edge functions, one per edge, positive on the inside
+			for (unsigned int e = 0; e < 3; e++)
+			{
+				const glm::vec3& from = screen[e];
+				const glm::vec3& to = screen[(e + 1) % 3];
+
+				// Always take the constant from the same end of the edge, so a shared edge gets exactly the negated function in the
+				// neighbouring triangle and every pixel along it is covered by one or the other, leaving no cracks
+				const glm::vec3& origin = from.x < to.x || (from.x == to.x && from.y < to.y) ? from : to;
+
+				triangle.edgeA[e] = from.y - to.y;
+				triangle.edgeB[e] = to.x - from.x;
+				triangle.edgeC[e] = -(triangle.edgeA[e] * origin.x + triangle.edgeB[e] * origin.y);
+			}
+
+			// Depth is linear in screen space after the perspective divide
+			float dzB = screen[1].z - screen[0].z;
+			float dzC = screen[2].z - screen[0].z;
+			triangle.depthA = (dzB * ac.y - dzC * ab.y) / area;
+			triangle.depthB = (dzC * ab.x - dzB * ac.x) / area;
+			triangle.depthC = screen[0].z - triangle.depthA * screen[0].x - triangle.depthB * screen[0].y;
+
+			screenTriangles.push_back(triangle);
+		}
+	}
+}
+
+// Build each pyramid level from the one below, keeping the nearest and farthest depth of each 2 x 2 block
+static void BuildPyramid()
+{
+	DepthLevel& base = depthLevels[0];
+	base.maximum = base.minimum;
+
+	for (unsigned int i = 1; i < depthLevels.size(); i++)
+	{
+		const DepthLevel& source = depthLevels[i - 1];
+		DepthLevel& level = depthLevels[i];
+
+		for (unsigned int y = 0; y < level.height; y++)
+		{
+			unsigned int y0 = y * 2;
+			unsigned int y1 = std::min(y0 + 1, source.height - 1);
+
+			for (unsigned int x = 0; x < level.width; x++)
+			{
+				unsigned int x0 = x * 2;
+				unsigned int x1 = std::min(x0 + 1, source.width - 1);
+
+				unsigned int s00 = y0 * source.width + x0, s01 = y0 * source.width + x1;
+				unsigned int s10 = y1 * source.width + x0, s11 = y1 * source.width + x1;
+
+				level.minimum[y * level.width + x] = std::min(std::min(source.minimum[s00], source.minimum[s01]), std::min(source.minimum[s10], source.minimum[s11]));
+				level.maximum[y * level.width + x] = std::max(std::max(source.maximum[s00], source.maximum[s01]), std::max(source.maximum[s10], source.maximum[s11]));
+			}
+		}
+	}
+}
+
+void RasterizeOccluders()
+{
+	TRACE_SCOPE("RasterizeOccluders");
+
+	// Clear to the far plane
+	std::fill(depthLevels[0].minimum.begin(), depthLevels[0].minimum.end(), 1.0f);
+
+	SetupTriangles();
+
+	if (!screenTriangles.empty())
+	{
+		// Start the workers on their bands
+		{
+			std::lock_guard<std::mutex> lock(workMutex);
+			workRemaining = workers.size();
+			workGeneration++;
+		}
+
+		workStart.notify_all();
+
+		// Do band 0 here, then wait for the rest
+		{
+			TRACE_SCOPE("RasterizeBand");
+			int startY, endY;
+			BandRows(0, startY, endY);
+			RasterizeBand(startY, endY);
+		}
+
+		std::unique_lock<std::mutex> lock(workMutex);
+		workDone.wait(lock, [] { return workRemaining == 0; });
+	}
+
+	BuildPyramid();
+}
+
+bool BoxOccluded(const glm::vec3& center, const glm::vec3& extent)
+{
+	// Project the corners, tracking the screen rectangle and the nearest depth
+	float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+	float nearest = FLT_MAX;
+
+	for (unsigned int i = 0; i < 8; i++)
+	{
+		glm::vec3 corner = center + extent * glm::vec3(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, i & 4 ? 1.0f : -1.0f);
+		glm::vec4 clip = occlusionViewProjection * glm::vec4(corner, 1.0f);
+
+		// Reaches behind the camera, treat as visible
+		if (clip.w <= 1e-5f)
+			return false;
+
+		glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		minX = std::min(minX, ndc.x);
+		maxX = std::max(maxX, ndc.x);
+		minY = std::min(minY, ndc.y);
+		maxY = std::max(maxY, ndc.y);
+		nearest = std::min(nearest, ndc.z * 0.5f + 0.5f);
+	}
+
+	// Crossing the near plane
+	if (nearest <= 0.0f)
+		return false;
+
+	// Rectangle in level 0 pixels, clamped to the buffer
+	int x0 = std::max((int)std::floor((minX * 0.5f + 0.5f) * OCCLUSION_WIDTH), 0);
+	int x1 = std::min((int)std::floor((maxX * 0.5f + 0.5f) * OCCLUSION_WIDTH), (int)OCCLUSION_WIDTH - 1);
+	int y0 = std::max((int)std::floor((minY * 0.5f + 0.5f) * OCCLUSION_HEIGHT), 0);
+	int y1 = std::min((int)std::floor((maxY * 0.5f + 0.5f) * OCCLUSION_HEIGHT), (int)OCCLUSION_HEIGHT - 1);
+
+	// Off screen, that's for the frustum test to decide
+	if (x0 > x1 || y0 > y1)
+		return false;
+
+	// Go up the pyramid until the rectangle covers at most 2 texels each way (3 with misalignment)
+	unsigned int level = 0;
+	int size = std::max(x1 - x0, y1 - y0) + 1;
+
+	while (size > 2 && level + 1 < depthLevels.size())
+	{
+		size = (size + 1) / 2;
+		level++;
+	}
+
+	// Quick accept: in front of the nearest depth of every texel of a coarser level covering the rectangle, so in
+	// front of everything there. Two levels up the rectangle covers at most two texels each way.
+	unsigned int coarse = std::min(level + 2, (unsigned int)depthLevels.size() - 1);
+	const DepthLevel& coarseDepth = depthLevels[coarse];
+	float coarseNearest = FLT_MAX;
+
+	for (int y = y0 >> coarse; y <= y1 >> coarse; y++)
+	{
+		for (int x = x0 >> coarse; x <= x1 >> coarse; x++)
+			coarseNearest = std::min(coarseNearest, coarseDepth.minimum[y * coarseDepth.width + x]);
+	}
+
+	if (nearest <= coarseNearest)
+		return false;
+
+	const DepthLevel& depth = depthLevels[level];
+	x0 >>= level;
+	x1 >>= level;
+	y0 >>= level;
+	y1 >>= level;
+
+	// Hidden if the box's nearest point is behind the farthest occluder depth everywhere it covers
+	for (int y = y0; y <= y1; y++)
+	{
+		for (int x = x0; x <= x1; x++)
+		{
+			if (nearest <= depth.maximum[y * depth.width + x])
+				return false;
+		}
+	}
+
+	return true;
+}
+
+unsigned int CullOccludedBoxes(const BoxList& boxes, std::vector<unsigned char>& visible)
+{
+	unsigned int hidden = 0;
+
+	for (unsigned int i = 0; i < boxes.Size(); i++)
+	{
+		if (!visible[i])
+			continue;
+
+		glm::vec3 center(boxes.centerX[i], boxes.centerY[i], boxes.centerZ[i]);
+		glm::vec3 extent(boxes.extentX[i], boxes.extentY[i], boxes.extentZ[i]);
+
+		if (BoxOccluded(center, extent))
+		{
+			visible[i] = 0;
+			hidden++;
+		}
+	}
+
+	return hidden;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vector>
+
+#include "maths.h"
+#include "culling.h"
+
+// Size of the software depth buffer. Much smaller than the screen, occluders only need to be roughly right.
+const unsigned int OCCLUSION_WIDTH = 256;
+const unsigned int OCCLUSION_HEIGHT = 128;
+
+// Struct to hold a CPU copy of a mesh's triangles, for drawing into the occlusion buffer
+struct Occluder
+{
+	std::vector<glm::vec3> vertices; // model space positions
+	std::vector<unsigned int> indices;
+};
+
+// Software hierarchical-Z occlusion culling. Each frame a few large occluders are rasterized into a low
+// resolution depth buffer on the CPU, split into horizontal bands across worker threads and shaded four
+// pixels at a time with SSE. A min/max depth pyramid is built from it, and bounds are tested against the
+// pyramid level where they cover a couple of texels. Doesn't touch GL, so it runs without a GPU.
+void InitialiseOcclusion(unsigned int threadCount); // start threadCount worker threads, 0 rasterizes on the calling thread only
+void ShutdownOcclusion();
+
+void BeginOcclusionFrame(const glm::mat4& viewProjection); // clear the queue, set the camera for this frame
+void AddOccluder(const Occluder* occluder, const glm::mat4& model); // queue an occluder, drawn in RasterizeOccluders
+void RasterizeOccluders(); // draw every queued occluder and build the pyramid
+
+// Test a world space box against the pyramid. True if it is certainly hidden behind the occluders.
+bool BoxOccluded(const glm::vec3& center, const glm::vec3& extent);
+
+// Test every box that is still visible, clearing visible[i] for hidden ones. Returns how many were hidden.
+unsigned int CullOccludedBoxes(const BoxList& boxes, std::vector<unsigned char>& visible);
@@ -34,7 +34,7 @@ solution "OpenGL-SDL2-and-Assimp"
 		configuration { "windows" }
 			links { "SDL/SDL2", "SDL/SDL2main", "SDL/SDL2_image", "opengl32", "GL/glew32", "ASSIMP/assimp" }
 		configuration { "linux" }
-			links { "SDL2", "SDL2main", "SDL2_image", "GL", "GLEW", "assimp" }
+			links { "SDL2", "SDL2main", "SDL2_image", "GL", "EGL", "GLEW", "assimp", "pthread" }
 		configuration {}
 		
 		-- Post build commands
@@ -0,0 +1,152 @@
+#include "ringbuffer.h"
+#include "glstate.h"
+
+#include <iostream>
+#include <vector>
+
+// Ring state
+static GLuint ringBuffer = 0;
+static GLsizeiptr ringFrameSize = 0;
+static bool ringPersistent = false;
+static char* ringMapping = nullptr; // persistent mapping of the whole buffer
+static std::vector<char> ringStaging; // CPU copy of the current region, without persistent mapping
+
+// Current region
+static unsigned int ringFrame = 0;
+static GLsizeiptr ringUsed = 0;
+static bool ringFullReported = false;
+static GLsync ringFences[RING_FRAME_COUNT] = { 0 };
+
+void CreateRingBuffer(GLsizeiptr frameSize)
+{
+	ringFrameSize = frameSize;
+	ringPersistent = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+
+	glGenBuffers(1, &ringBuffer);
+	StateBindBuffer(GL_COPY_WRITE_BUFFER, ringBuffer);
+
+	if (ringPersistent)
+	{
+		// Immutable storage, mapped once for the whole run. Coherent, so writes need no explicit flush.
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_COPY_WRITE_BUFFER, frameSize * RING_FRAME_COUNT, NULL, flags);
+		ringMapping = (char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, frameSize * RING_FRAME_COUNT, flags);
+
+		if (ringMapping == nullptr)
+		{
+			std::cout << "Failed to map ring buffer, falling back to orphaning" << std::endl;
+
+			// Storage is immutable, so start again with a new buffer
+			StateDeleteBuffers(1, &ringBuffer);
+			glGenBuffers(1, &ringBuffer);
+			StateBindBuffer(GL_COPY_WRITE_BUFFER, ringBuffer);
+			ringPersistent = false;
+		}
+	}
+
+	if (!ringPersistent)
+	{
+		StateBufferData(GL_COPY_WRITE_BUFFER, frameSize * RING_FRAME_COUNT, NULL, GL_STREAM_DRAW);
+		ringStaging.resize(frameSize);
+	}
+
+	std::cout << "Ring buffer: " << RING_FRAME_COUNT << " x " << frameSize / 1024 << " KB, " << (ringPersistent ? "persistent mapped" : "orphaned") << std::endl;
+
+	// Start on the last region, so the first frame moves to region 0
+	ringFrame = RING_FRAME_COUNT - 1;
+	ringUsed = 0;
+}
+
+void DestroyRingBuffer()
+{
+	for (unsigned int i = 0; i < RING_FRAME_COUNT; i++)
+	{
+		if (ringFences[i] != 0)
+			glDeleteSync(ringFences[i]);
+
+		ringFences[i] = 0;
+	}
+
+	if (ringMapping != nullptr)
+	{
+		StateBindBuffer(GL_COPY_WRITE_BUFFER, ringBuffer);
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		ringMapping = nullptr;
+	}
+
+	StateDeleteBuffers(1, &ringBuffer);
+	ringStaging.clear();
+}
+
+GLuint GetRingBuffer()
+{
+	return ringBuffer;
+}
+
+void BeginRingFrame()
+{
+	ringFrame = (ringFrame + 1) % RING_FRAME_COUNT;
+	ringUsed = 0;
+
+	// Wait for the GPU to finish the frame that last used this region. Normally it has, this only blocks when we are GPU bound.
+	GLsync& fence = ringFences[ringFrame];
+
+	if (fence != 0)
+	{
+		GLbitfield flags = 0;
+
+		while (glClientWaitSync(fence, flags, 1000000) == GL_TIMEOUT_EXPIRED)
+			flags = GL_SYNC_FLUSH_COMMANDS_BIT; // make sure the fence gets submitted if we have to wait
+
+		glDeleteSync(fence);
+		fence = 0;
+	}
+}
+
+RingAllocation AllocateRing(GLsizeiptr size, GLsizeiptr alignment)
+{
+	RingAllocation allocation;
+	GLintptr regionStart = ringFrame * ringFrameSize;
+
+	// Align the absolute offset, so attribute offsets that are a multiple of a struct size line up
+	GLintptr offset = (regionStart + ringUsed + alignment - 1) / alignment * alignment;
+
+	if (offset + size > regionStart + ringFrameSize)
+	{
+		if (!ringFullReported)
+			std::cout << "Ring buffer frame is full, " << size << " bytes requested" << std::endl;
+
+		ringFullReported = true;
+		return allocation;
+	}
+
+	ringUsed = offset + size - regionStart;
+
+	allocation.data = ringPersistent ? ringMapping + offset : ringStaging.data() + (offset - regionStart);
+	allocation.offset = offset;
+	allocation.size = size;
+
+	return allocation;
+}
+
+void FlushRingFrame()
+{
+	// Coherent persistent mappings are visible to every command issued after the write
+	if (ringPersistent)
+		CountBufferUpload(ringUsed);
+
+	if (ringPersistent || ringUsed == 0)
+		return;
+
+	// Orphan, so the driver hands us fresh storage instead of waiting on draws from the last frame, then copy this frame's region in
+	StateBindBuffer(GL_COPY_WRITE_BUFFER, ringBuffer);
+	StateBufferData(GL_COPY_WRITE_BUFFER, ringFrameSize * RING_FRAME_COUNT, NULL, GL_STREAM_DRAW);
+	StateBufferSubData(GL_COPY_WRITE_BUFFER, ringFrame * ringFrameSize, ringUsed, ringStaging.data());
+}
+
+void EndRingFrame()
+{
+	// Orphaned storage is tracked by the driver, only the persistent mapping needs fencing
+	if (ringPersistent)
+		ringFences[ringFrame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
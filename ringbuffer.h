@@ -0,0 +1,28 @@
+#pragma once
+
+#include <GL/glew.h>
+
+// Number of frames the ring is split into. The CPU writes one while the GPU may still be reading the other two.
+const unsigned int RING_FRAME_COUNT = 3;
+
+// Struct to hold a piece of the current frame's region
+struct RingAllocation
+{
+	void* data = nullptr; // write here, null if the frame's region is full
+	GLintptr offset = 0; // offset from the start of the ring buffer, for binding or attribute offsets
+	GLsizeiptr size = 0;
+};
+
+// Streaming buffer for per frame data (camera block, draw commands, per draw data), split into
+// RING_FRAME_COUNT regions used in turn. With GL_ARB_buffer_storage the buffer is mapped once,
+// persistently and coherently, and written directly. Each region is fenced after the frame's draws, and
+// the CPU only waits if it comes back round to a region the GPU hasn't finished with. Without it, writes
+// go to a CPU copy and the buffer is orphaned and refilled once per frame.
+void CreateRingBuffer(GLsizeiptr frameSize); // frameSize bytes per region, prints which path was chosen
+void DestroyRingBuffer();
+GLuint GetRingBuffer(); // buffer name, the same for the whole run
+
+void BeginRingFrame(); // move to the next region, waiting on its fence if the GPU is still using it
+RingAllocation AllocateRing(GLsizeiptr size, GLsizeiptr alignment); // alignment doesn't have to be a power of two
+void FlushRingFrame(); // make everything written this frame visible to GL, before the draws that read it
+void EndRingFrame(); // fence the region, after the last draw that reads it
@@ -0,0 +1,477 @@
+#include "shader.h"
+#include "glstate.h"
+#include "trace.h"
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <regex>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <SDL/SDL.h>
+
+typedef void (GLAPIENTRY *MaxShaderCompilerThreadsProc)(GLuint count);
+
+// Raw file contents, keyed by path. Each file is only read from disk once.
+static std::unordered_map<std::string, std::string> shaderFileCache;
+
+// Expanded shader sources, keyed by content hash
+static std::unordered_map<unsigned long long, ShaderSource> shaderSourceCache;
+
+// Returned when a shader can't be loaded
+static const ShaderSource emptyShaderSource;
+
+// 64 bit FNV-1a hash
+static unsigned long long HashString(const std::string& string, unsigned long long hash = 14695981039346656037ULL)
+{
+	for (unsigned char c : string)
+	{
+		hash ^= c;
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+// Directory part of a path, including the trailing slash
+static std::string DirectoryOf(const std::string& filename)
+{
+	size_t slash = filename.find_last_of("/\\");
+	return slash == std::string::npos ? std::string() : filename.substr(0, slash + 1);
+}
+
+// Read a whole file with a single read, rather than line by line
+static const std::string* ReadShaderFile(const std::string& filename)
+{
+	// Already read?
+	auto cached = shaderFileCache.find(filename);
+
+	if (cached != shaderFileCache.end())
+		return &cached->second;
+
+	std::ifstream file(filename, std::ios::in | std::ios::binary);
+
+	if (!file.is_open())
+		return nullptr;
+
+	// Size the string up front, then read straight into it
+	std::string contents;
+	file.seekg(0, std::ios::end);
+	contents.resize((size_t)file.tellg());
+	file.seekg(0, std::ios::beg);
+	file.read(&contents[0], contents.size());
+
+	return &(shaderFileCache[filename] = std::move(contents));
+}
+
+// Parse the file name out of a line like: #include "file"
+static bool ParseInclude(const std::string& line, std::string& include)
+{
+	size_t start = line.find_first_not_of(" \t");
+
+	if (start == std::string::npos || line.compare(start, 8, "#include") != 0)
+		return false;
+
+	size_t open = line.find('"', start + 8);
+	size_t close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+
+	if (close == std::string::npos)
+		return false;
+
+	include = line.substr(open + 1, close - open - 1);
+	return true;
+}
+
+// Version number from the #version line, 110 if there isn't one as GLSL assumes
+static unsigned int ParseVersion(const std::string& contents)
+{
+	size_t version = contents.find("#version");
+
+	if (version == std::string::npos)
+		return 110;
+
+	return (unsigned int)strtoul(contents.c_str() + version + 8, nullptr, 10);
+}
+
+// Update whether we are inside a /* */ comment at the end of a line
+static void ScanComments(const std::string& line, bool& inBlockComment)
+{
+	for (size_t i = 0; i + 1 < line.size(); i++)
+	{
+		if (inBlockComment)
+		{
+			if (line[i] == '*' && line[i + 1] == '/')
+			{
+				inBlockComment = false;
+				i++;
+			}
+		}
+		else if (line[i] == '/' && line[i + 1] == '/')
+		{
+			return;
+		}
+		else if (line[i] == '/' && line[i + 1] == '*')
+		{
+			inBlockComment = true;
+			i++;
+		}
+	}
+}
+
+// #line directive making the next line number line of source string fileIndex. Before GLSL 3.30 #line numbers
+// the directive's own line, so the line after it is one more.
+static std::string LineDirective(unsigned int line, unsigned int fileIndex, unsigned int version)
+{
+	return "#line " + std::to_string(version < 330 ? line - 1 : line) + " " + std::to_string(fileIndex) + "\n";
+}
+
+// Copy contents into the shader source, recursively replacing #include lines with the included file.
+// #include lines inside /* */ comments are left alone, // comments never parse as one.
+static void ExpandIncludes(const std::string& filename, const std::string& contents, unsigned int fileIndex, ShaderSource& shader, std::unordered_set<std::string>& included)
+{
+	size_t position = 0;
+	unsigned int lineNumber = 0;
+	bool inBlockComment = false;
+
+	while (position < contents.size())
+	{
+		// Next line, without the newline
+		size_t end = contents.find('\n', position);
+		if (end == std::string::npos) end = contents.size();
+
+		std::string line = contents.substr(position, end - position);
+		position = end + 1;
+		lineNumber++;
+
+		std::string include;
+
+		if (inBlockComment || !ParseInclude(line, include))
+		{
+			ScanComments(line, inBlockComment);
+			shader.source.append(line);
+			shader.source.append("\n");
+			continue;
+		}
+
+		// Includes are relative to the including file
+		std::string path = DirectoryOf(filename) + include;
+
+		// Include guard, each file only goes in once. Keep an empty line so line numbers still match.
+		if (!included.insert(path).second)
+		{
+			shader.source.append("\n");
+			continue;
+		}
+
+		const std::string* includeContents = ReadShaderFile(path);
+
+		if (includeContents == nullptr)
+		{
+			std::cout << "Couldn't open shader include: " << path << " (" << filename << ":" << lineNumber << ")" << std::endl;
+			shader.source.append("\n");
+			continue;
+		}
+
+		// Number the included file as its own source string, so errors can be mapped back to it
+		unsigned int includeIndex = shader.files.size();
+		shader.files.push_back(path);
+
+		shader.source.append(LineDirective(1, includeIndex, shader.version));
+		ExpandIncludes(path, *includeContents, includeIndex, shader, included);
+
+		// Carry on from the line after the #include
+		shader.source.append(LineDirective(lineNumber + 1, fileIndex, shader.version));
+	}
+}
+
+const ShaderSource& LoadShaderSource(const std::string& filename)
+{
+	const std::string* contents = ReadShaderFile(filename);
+
+	if (contents == nullptr)
+	{
+		std::cout << "Couldn't open shader: " << filename << std::endl;
+		return emptyShaderSource;
+	}
+
+	// Includes resolve relative to the file, so the directory is part of the key
+	unsigned long long hash = HashString(DirectoryOf(filename), HashString(*contents));
+
+	// Already expanded?
+	auto cached = shaderSourceCache.find(hash);
+
+	if (cached != shaderSourceCache.end())
+		return cached->second;
+
+	ShaderSource& shader = shaderSourceCache[hash];
+	shader.hash = hash;
+	shader.files.push_back(filename);
+	shader.version = ParseVersion(*contents);
+	shader.source.reserve(contents->size());
+
+	std::unordered_set<std::string> included;
+	included.insert(filename);
+
+	ExpandIncludes(filename, *contents, 0, shader, included);
+	shader.loaded = true;
+
+	return shader;
+}
+
+void ClearShaderSourceCache()
+{
+	shaderFileCache.clear();
+	shaderSourceCache.clear();
+}
+
+std::string MapShaderLog(const std::string& log, const ShaderSource& source)
+{
+	// Matches the location at the start of a log line, e.g. "0(12) : error" (NVIDIA) or "ERROR: 0:12:" / "0:12(5): error" (AMD, Mesa)
+	static const std::regex location("^((?:ERROR|WARNING): )?(\\d+)([:(])(\\d+)");
+
+	std::string mapped;
+	size_t position = 0;
+
+	while (position < log.size())
+	{
+		size_t end = log.find('\n', position);
+		if (end == std::string::npos) end = log.size();
+
+		std::string line = log.substr(position, end - position);
+		position = end + 1;
+
+		std::smatch match;
+
+		if (std::regex_search(line, match, location))
+		{
+			unsigned long index = std::stoul(match[2].str());
+
+			// Replace the source string number with its file name
+			if (index < source.files.size())
+				line = match[1].str() + source.files[index] + match[3].str() + match[4].str() + match.suffix().str();
+		}
+
+		mapped.append(line);
+		mapped.append("\n");
+	}
+
+	return mapped;
+}
+
+// Shader manager state
+static std::vector<ShaderProgram*> shaderPrograms;
+static bool parallelShaderCompile = false;
+static std::chrono::steady_clock::time_point warmUpStart;
+static std::chrono::steady_clock::time_point warmUpEnd;
+static std::chrono::steady_clock::duration warmUpWaiting;
+static bool warmUpStarted = false;
+
+// Check the context's extension list, glew doesn't know about every extension
+static bool HasExtension(const char* name)
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+
+	for (GLint i = 0; i < count; i++)
+	{
+		if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+void InitialiseShaderManager()
+{
+	parallelShaderCompile = HasExtension("GL_KHR_parallel_shader_compile") || HasExtension("GL_ARB_parallel_shader_compile");
+
+	if (parallelShaderCompile)
+	{
+		// Let the driver pick how many compiler threads to use
+		MaxShaderCompilerThreadsProc maxShaderCompilerThreads = (MaxShaderCompilerThreadsProc)SDL_GL_GetProcAddress("glMaxShaderCompilerThreadsKHR");
+
+		if (maxShaderCompilerThreads == nullptr)
+			maxShaderCompilerThreads = (MaxShaderCompilerThreadsProc)SDL_GL_GetProcAddress("glMaxShaderCompilerThreadsARB");
+
+		if (maxShaderCompilerThreads != nullptr)
+			maxShaderCompilerThreads(0xFFFFFFFF);
+	}
+
+	std::cout << "Parallel shader compile: " << (parallelShaderCompile ? "yes" : "no") << std::endl;
+}
+
+// Create a shader and submit its compile, without asking for the result
+static GLuint SubmitShader(GLenum type, const ShaderSource& source)
+{
+	GLuint shader = glCreateShader(type);
+
+	// Convert source to GLchar*
+	const GLchar* sourceGL = source.source.c_str();
+	GLint sourceLength = source.source.length();
+
+	glShaderSource(shader, 1, &sourceGL, &sourceLength);
+	glCompileShader(shader);
+
+	return shader;
+}
+
+// Print the log of a shader that failed to compile
+static bool CheckShader(GLuint shader, const ShaderSource& source, const std::string& name, const char* stage)
+{
+	GLint status;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+
+	if (status == GL_FALSE)
+	{
+		GLchar error[1024] = { 0 };
+		glGetShaderInfoLog(shader, sizeof(error), NULL, error);
+		std::cout << "Error compiling " << stage << " shader (" << name << "): " << MapShaderLog(error, source) << std::endl;
+	}
+
+	return status == GL_TRUE;
+}
+
+ShaderProgram* QueueShaderProgram(const std::string& name, const std::string& vertexFile, const std::string& fragmentFile)
+{
+	// Time from the first submission until every program is finished
+	if (!warmUpStarted)
+	{
+		warmUpStart = std::chrono::steady_clock::now();
+		warmUpWaiting = std::chrono::steady_clock::duration::zero();
+		warmUpStarted = true;
+	}
+
+	ShaderProgram* shader = new ShaderProgram();
+	shader->name = name;
+	shader->id = shaderPrograms.size();
+
+	// Load shader source, with #includes expanded
+	shader->vertexSource = &LoadShaderSource(vertexFile);
+	shader->fragmentSource = &LoadShaderSource(fragmentFile);
+
+	// Submit both compiles and the link. None of these wait on the compiler.
+	shader->program = glCreateProgram();
+	shader->vertexShader = SubmitShader(GL_VERTEX_SHADER, *shader->vertexSource);
+	shader->fragmentShader = SubmitShader(GL_FRAGMENT_SHADER, *shader->fragmentSource);
+
+	glAttachShader(shader->program, shader->vertexShader);
+	glAttachShader(shader->program, shader->fragmentShader);
+
+	// Pin attribute locations, so every program agrees with the vertex array objects
+	glBindAttribLocation(shader->program, VERTEX_ATTRIB, "vertex");
+	glBindAttribLocation(shader->program, UV_ATTRIB, "uv");
+	glBindAttribLocation(shader->program, INSTANCE_MATRIX_ATTRIB, "instanceMatrix");
+	glBindAttribLocation(shader->program, INSTANCE_COLOR_ATTRIB, "instanceColor");
+
+	glLinkProgram(shader->program);
+
+	shaderPrograms.push_back(shader);
+
+	return shader;
+}
+
+bool FinishShaderProgram(ShaderProgram* shader)
+{
+	if (shader->finished)
+		return shader->linked;
+
+	shader->finished = true;
+
+	// Check the link first, if that worked the compiles did too. This is where we wait on the driver if it isn't done.
+	std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+
+	GLint status;
+	glGetProgramiv(shader->program, GL_LINK_STATUS, &status);
+	shader->linked = status == GL_TRUE;
+
+	// Keep track of how long we were blocked, and when the last program was ready
+	warmUpEnd = std::chrono::steady_clock::now();
+	warmUpWaiting += warmUpEnd - waitStart;
+
+	if (!shader->linked)
+	{
+		// Find out which stage failed
+		bool compiled = CheckShader(shader->vertexShader, *shader->vertexSource, shader->name, "vertex");
+		compiled = CheckShader(shader->fragmentShader, *shader->fragmentSource, shader->name, "fragment") && compiled;
+
+		if (compiled)
+		{
+			GLchar error[1024] = { 0 };
+			glGetProgramInfoLog(shader->program, sizeof(error), NULL, error);
+			std::cout << "Error linking shader program (" << shader->name << "): " << error << std::endl;
+		}
+
+		return false;
+	}
+
+	// Store uniforms
+	shader->modelViewProjectionUniform = glGetUniformLocation(shader->program, "modelViewProjection");
+	shader->modelUniform = glGetUniformLocation(shader->program, "model");
+	shader->diffuseColorUniform = glGetUniformLocation(shader->program, "diffuseColor");
+
+	// Attach the camera uniform block to the shared binding point
+	GLuint cameraBlockIndex = glGetUniformBlockIndex(shader->program, "Camera");
+
+	if (cameraBlockIndex != GL_INVALID_INDEX)
+		glUniformBlockBinding(shader->program, cameraBlockIndex, CAMERA_BLOCK_BINDING);
+
+	// Samplers never change unit, so set them once
+	GLint diffuseTextureUniform = glGetUniformLocation(shader->program, "diffuseTexture");
+
+	if (diffuseTextureUniform != -1)
+	{
+		StateUseProgram(shader->program);
+		StateUniform1i(diffuseTextureUniform, DIFFUSE_TEXTURE_UNIT);
+	}
+
+	return true;
+}
+
+void UseShaderProgram(ShaderProgram* shader)
+{
+	// First use, wait for the driver
+	if (!shader->finished)
+		FinishShaderProgram(shader);
+
+	StateUseProgram(shader->program);
+}
+
+void FinishShaderPrograms()
+{
+	TRACE_SCOPE("FinishShaderPrograms");
+
+	for (ShaderProgram* shader : shaderPrograms)
+		FinishShaderProgram(shader);
+
+	if (!warmUpStarted)
+		return;
+
+	// Report how long it took from submitting the first compile to having every program ready, and how much of that the CPU spent waiting
+	float milliseconds = std::chrono::duration<float, std::milli>(warmUpEnd - warmUpStart).count();
+	float waitingMilliseconds = std::chrono::duration<float, std::milli>(warmUpWaiting).count();
+	std::cout << "Shader warm-up: " << milliseconds << "ms for " << shaderPrograms.size() << " program(s), " << waitingMilliseconds << "ms waiting on the driver" << std::endl;
+
+	warmUpStarted = false;
+}
+
+void UnloadShaderPrograms()
+{
+	for (ShaderProgram* shader : shaderPrograms)
+	{
+		// Detach and delete shaders
+		glDetachShader(shader->program, shader->vertexShader);
+		glDeleteShader(shader->vertexShader);
+		glDetachShader(shader->program, shader->fragmentShader);
+		glDeleteShader(shader->fragmentShader);
+
+		// Delete shader program
+		StateDeleteProgram(shader->program);
+
+		delete shader;
+	}
+
+	shaderPrograms.clear();
+}
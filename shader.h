@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+// Struct to hold a shader source after #include expansion
+struct ShaderSource
+{
+	std::string source; // expanded source, ready for glShaderSource
+	std::vector<std::string> files; // file names, indexed by the #line source string number
+	unsigned long long hash = 0; // content hash of the root file
+	unsigned int version = 110; // #version of the root file, which decides how #line numbers lines
+	bool loaded = false;
+};
+
+// Load a shader from file and expand its #include "file" directives. Each file is read with one bulk
+// read and only once, every file is included at most once per shader (an implicit include guard), and
+// expanded sources are cached by the content hash of the root file.
+const ShaderSource& LoadShaderSource(const std::string& filename);
+void ClearShaderSourceCache(); // drop cached files and expanded sources, e.g. to reload from disk
+
+// Rewrite "0(12)" / "0:12" style locations in a compile log to the original file names, using the
+// #line source string numbers written during #include expansion
+std::string MapShaderLog(const std::string& log, const ShaderSource& source);
+
+// Attribute locations, bound before every program is linked so one vertex array object works with any program
+const GLuint VERTEX_ATTRIB = 0;
+const GLuint UV_ATTRIB = 1;
+const GLuint INSTANCE_MATRIX_ATTRIB = 2; // mat4, takes locations 2 to 5
+const GLuint INSTANCE_COLOR_ATTRIB = 6;
+
+// Uniform block binding points, every program's blocks are attached to these
+const GLuint CAMERA_BLOCK_BINDING = 0;
+
+// Texture units for material samplers
+const GLint DIFFUSE_TEXTURE_UNIT = 0;
+
+// Struct to hold a shader program owned by the shader manager
+struct ShaderProgram
+{
+	std::string name;
+	unsigned int id = 0; // small index, for packing into sort keys
+	const ShaderSource* vertexSource = nullptr;
+	const ShaderSource* fragmentSource = nullptr;
+	GLuint program = 0;
+	GLuint vertexShader = 0;
+	GLuint fragmentShader = 0;
+	bool finished = false; // compile and link status has been queried
+	bool linked = false;
+
+	// Uniform locations, -1 if the program doesn't use them. Stored when the program is finished.
+	GLint modelViewProjectionUniform = -1;
+	GLint modelUniform = -1;
+	GLint diffuseColorUniform = -1;
+};
+
+// The shader manager submits every compile and link up front, and only asks for their status when a
+// program is first needed. Querying status straight after glCompileShader forces the driver to finish
+// that compile before the next one can start; deferring it lets the driver compile in the background
+// (in parallel with GL_KHR_parallel_shader_compile) while the CPU gets on with loading models.
+void InitialiseShaderManager(); // detect parallel shader compile support
+ShaderProgram* QueueShaderProgram(const std::string& name, const std::string& vertexFile, const std::string& fragmentFile); // submit compile and link without waiting
+bool FinishShaderProgram(ShaderProgram* program); // query compile and link status, blocking if not done. Returns true if linked.
+void UseShaderProgram(ShaderProgram* program); // finish the program if this is its first use, then glUseProgram
+void FinishShaderPrograms(); // finish every queued program and report the total warm-up time
+void UnloadShaderPrograms(); // delete every program
@@ -0,0 +1,8 @@
+// Camera uniforms, shared by every program at binding point 0
+layout(std140) uniform Camera
+{
+	mat4 cameraView;
+	mat4 cameraProjection;
+	mat4 cameraViewProjection;
+	vec4 cameraPosition;
+};
\ No newline at end of file
@@ -0,0 +1,13 @@
+#version 140
+
+// Final color out
+out vec4 finalColor;
+
+// Material data
+uniform vec3 diffuseColor;
+
+void main()
+{
+	// Final color
+	finalColor = vec4(diffuseColor, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,6 @@
+#version 140
+
+// Depth pre-pass, color writes are off so there is nothing to output
+void main()
+{
+}
\ No newline at end of file
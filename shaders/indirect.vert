@@ -0,0 +1,22 @@
+#version 140
+
+// In/out variables
+in vec3 vertex;
+in vec2 uv;
+out vec2 uvIn;
+out vec4 colorIn;
+
+// Per draw data, one element per draw selected by baseInstance
+in mat4 instanceMatrix; // model view projection, combined on the CPU
+in vec4 instanceColor;
+
+// Shared with the depth pre-pass, see shader.vert
+invariant gl_Position;
+
+void main()
+{
+	// Calculate position using MVP
+	gl_Position = instanceMatrix * vec4(vertex, 1.0);
+	uvIn = uv;
+	colorIn = instanceColor;
+}
\ No newline at end of file
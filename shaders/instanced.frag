@@ -0,0 +1,13 @@
+#version 140
+
+// Color from the per draw or per instance data
+in vec4 colorIn;
+
+// Final color out
+out vec4 finalColor;
+
+void main()
+{
+	// Final color
+	finalColor = colorIn;
+}
\ No newline at end of file
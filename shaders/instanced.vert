@@ -0,0 +1,22 @@
+#version 140
+
+// In/out variables
+in vec3 vertex;
+in vec2 uv;
+out vec2 uvIn;
+out vec4 colorIn;
+
+// Per instance data
+in mat4 instanceMatrix; // model matrix
+in vec4 instanceColor;
+
+// Camera uniforms
+#include "camera.glsl"
+
+void main()
+{
+	// Model matrix per instance, view projection shared by every instance
+	gl_Position = cameraViewProjection * (instanceMatrix * vec4(vertex, 1.0));
+	uvIn = uv;
+	colorIn = instanceColor;
+}
\ No newline at end of file
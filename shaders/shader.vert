@@ -5,17 +5,19 @@ in vec3 vertex;
 in vec2 uv;
 out vec2 uvIn;
 
-// Model matrix
-uniform mat4 model;
+// Model view projection, combined on the CPU per object
+uniform mat4 modelViewProjection;
+
+// The depth pre-pass uses this shader too, and the main pass tests with GL_EQUAL, so depth must come out exactly the same
+invariant gl_Position;
 
 // Camera uniforms
-uniform mat4 cameraProjection;
-uniform mat4 cameraView;
+#include "camera.glsl"
 
 // Changed calculations to be in tangent space
 void main()
 {
 	// Calculate position using MVP
-	gl_Position = cameraProjection * cameraView * model * vec4(vertex, 1.0);
+	gl_Position = modelViewProjection * vec4(vertex, 1.0);
 	uvIn = uv;	
 }
\ No newline at end of file
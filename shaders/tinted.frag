@@ -0,0 +1,17 @@
+#version 140
+
+// Texture coords and per instance tint
+in vec2 uvIn;
+in vec4 colorIn;
+
+// Final color out
+out vec4 finalColor;
+
+// Texture data
+uniform sampler2D diffuseTexture;
+
+void main()
+{
+	// Texture is already linear, see shader.frag
+	finalColor = vec4(texture(diffuseTexture, uvIn).rgb, 1.0) * colorIn;
+}
\ No newline at end of file
@@ -0,0 +1,16 @@
+#version 140
+
+// Per instance tint
+in vec4 colorIn;
+
+// Final color out
+out vec4 finalColor;
+
+// Material data
+uniform vec3 diffuseColor;
+
+void main()
+{
+	// Final color
+	finalColor = vec4(diffuseColor, 1.0) * colorIn;
+}
\ No newline at end of file
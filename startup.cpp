@@ -0,0 +1,149 @@
+#include "startup.h"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include <SDL/SDL.h>
+
+#include "timing.h"
+
+// Struct to hold one timed step of startup
+struct StartupPhase
+{
+	std::string name;
+	unsigned int depth = 0; // nesting level, 0 for top level phases
+	double startSeconds = 0.0; // wall clock time from the start of the timeline
+	double wallSeconds = 0.0;
+	double cpuSeconds = 0.0; // process CPU time, so work on driver and worker threads counts too
+};
+
+// Struct to hold when an open phase started
+struct OpenPhase
+{
+	unsigned int index; // into startupPhases
+	Uint64 counter;
+	double cpuSeconds;
+};
+
+static std::vector<StartupPhase> startupPhases;
+static std::vector<OpenPhase> openPhases;
+
+// Start of the first phase, and the totals once finished
+static bool timelineStarted = false;
+static Uint64 timelineCounter = 0;
+static double timelineCPUSeconds = 0.0;
+static double totalWallSeconds = 0.0;
+static double totalCPUSeconds = 0.0;
+
+void BeginStartupPhase(const std::string& name)
+{
+	// Process age is read before the phase starts, so reading it isn't counted in the phase
+	double ageSeconds = timelineStarted ? 0.0 : ProcessAgeSeconds();
+
+	OpenPhase open;
+	open.counter = SDL_GetPerformanceCounter();
+	open.cpuSeconds = ProcessCPUSeconds();
+
+	if (!timelineStarted)
+	{
+		timelineStarted = true;
+		timelineCounter = open.counter;
+		timelineCPUSeconds = open.cpuSeconds;
+
+		// Start the timeline when the process was created, where the platform can tell, with the time before main as its first phase
+		Uint64 age = SecondsToCounter(ageSeconds);
+
+		if (age > 0 && age < open.counter)
+		{
+			timelineCounter = open.counter - age;
+			timelineCPUSeconds = 0.0;
+
+			StartupPhase beforeMain;
+			beforeMain.name = "Process start to main";
+			beforeMain.wallSeconds = CounterToSeconds(age);
+			beforeMain.cpuSeconds = open.cpuSeconds;
+			startupPhases.push_back(beforeMain);
+		}
+	}
+
+	open.index = startupPhases.size();
+
+	StartupPhase phase;
+	phase.name = name;
+	phase.depth = openPhases.size();
+	phase.startSeconds = CounterToSeconds(open.counter - timelineCounter);
+
+	startupPhases.push_back(phase);
+	openPhases.push_back(open);
+}
+
+void EndStartupPhase()
+{
+	if (openPhases.empty())
+		return;
+
+	const OpenPhase& open = openPhases.back();
+	StartupPhase& phase = startupPhases[open.index];
+	phase.wallSeconds = CounterToSeconds(SDL_GetPerformanceCounter() - open.counter);
+	phase.cpuSeconds = ProcessCPUSeconds() - open.cpuSeconds;
+
+	openPhases.pop_back();
+}
+
+void FinishStartupTimeline()
+{
+	while (!openPhases.empty())
+		EndStartupPhase();
+
+	if (timelineStarted)
+	{
+		totalWallSeconds = CounterToSeconds(SDL_GetPerformanceCounter() - timelineCounter);
+		totalCPUSeconds = ProcessCPUSeconds() - timelineCPUSeconds;
+	}
+}
+
+void PrintStartupTimeline()
+{
+	std::cout << std::left << std::setw(48) << "Startup phase" << std::right << std::setw(10) << "Start ms" << std::setw(10) << "Wall ms" << std::setw(10) << "CPU ms" << std::endl;
+	std::cout << std::fixed << std::setprecision(2);
+
+	for (const StartupPhase& phase : startupPhases)
+	{
+		std::cout << std::left << std::setw(48) << (std::string(phase.depth * 2, ' ') + phase.name) << std::right
+			<< std::setw(10) << phase.startSeconds * 1000.0 << std::setw(10) << phase.wallSeconds * 1000.0 << std::setw(10) << phase.cpuSeconds * 1000.0 << std::endl;
+	}
+
+	std::cout << std::left << std::setw(48) << "Total" << std::right << std::setw(10) << 0.0
+		<< std::setw(10) << totalWallSeconds * 1000.0 << std::setw(10) << totalCPUSeconds * 1000.0 << std::endl;
+
+	std::cout.unsetf(std::ios::floatfield);
+	std::cout << std::setprecision(6);
+}
+
+bool WriteStartupTimeline(const std::string& filename)
+{
+	std::ofstream file(filename.c_str());
+
+	if (!file)
+		return false;
+
+	// Names are quoted, as post-processing steps and texture paths could contain commas
+	file << "phase,depth,start_ms,wall_ms,cpu_ms" << std::endl;
+	file << std::fixed << std::setprecision(3);
+
+	for (const StartupPhase& phase : startupPhases)
+	{
+		std::string name = phase.name;
+
+		for (size_t i = name.find('"'); i != std::string::npos; i = name.find('"', i + 2))
+			name.insert(i, 1, '"');
+
+		file << '"' << name << "\"," << phase.depth << "," << phase.startSeconds * 1000.0 << "," << phase.wallSeconds * 1000.0 << "," << phase.cpuSeconds * 1000.0 << std::endl;
+	}
+
+	file << "\"Total\",0,0.000," << totalWallSeconds * 1000.0 << "," << totalCPUSeconds * 1000.0 << std::endl;
+
+	return file.good();
+}
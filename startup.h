@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string>
+
+// Startup timeline. Phases are timed on the wall clock and in process CPU time, and can nest. A CPU time
+// well below the wall time means the phase was mostly waiting, on the disk, the driver or the GPU.
+// The timeline starts at process creation where the platform reports it, otherwise at the first phase.
+// Phases can be ended on another thread, as long as the threads take turns.
+void BeginStartupPhase(const std::string& name);
+void EndStartupPhase();
+void FinishStartupTimeline(); // end any open phases and stop the total
+
+void PrintStartupTimeline(); // table of every phase, indented by nesting, with the total
+bool WriteStartupTimeline(const std::string& filename); // CSV, one row per phase. False if the file couldn't be written.
@@ -0,0 +1,146 @@
+#include "timing.h"
+
+#include <cmath>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#endif
+
+// Sleeping stops this far before the target, and spinning does the rest
+static const double SPIN_SECONDS = 0.002;
+
+double CounterToSeconds(Uint64 ticks)
+{
+	return (double)ticks / SDL_GetPerformanceFrequency();
+}
+
+Uint64 SecondsToCounter(double seconds)
+{
+	return (Uint64)(seconds * SDL_GetPerformanceFrequency());
+}
+
+double ProcessCPUSeconds()
+{
+#ifdef _WIN32
+	// Kernel and user time, in 100 nanosecond units
+	FILETIME creation, exited, kernel, user;
+
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exited, &kernel, &user))
+		return 0.0;
+
+	ULARGE_INTEGER kernelTime, userTime;
+	kernelTime.LowPart = kernel.dwLowDateTime;
+	kernelTime.HighPart = kernel.dwHighDateTime;
+	userTime.LowPart = user.dwLowDateTime;
+	userTime.HighPart = user.dwHighDateTime;
+
+	return (kernelTime.QuadPart + userTime.QuadPart) * 1e-7;
+#else
+	timespec time;
+
+	if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time) != 0)
+		return 0.0;
+
+	return time.tv_sec + time.tv_nsec * 1e-9;
+#endif
+}
+
+double ProcessAgeSeconds()
+{
+#ifdef _WIN32
+	// Creation time against the current time, both in 100 nanosecond units since 1601
+	FILETIME creation, exited, kernel, user, now;
+
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exited, &kernel, &user))
+		return 0.0;
+
+	GetSystemTimeAsFileTime(&now);
+
+	ULARGE_INTEGER creationTime, nowTime;
+	creationTime.LowPart = creation.dwLowDateTime;
+	creationTime.HighPart = creation.dwHighDateTime;
+	nowTime.LowPart = now.dwLowDateTime;
+	nowTime.HighPart = now.dwHighDateTime;
+
+	return nowTime.QuadPart > creationTime.QuadPart ? (nowTime.QuadPart - creationTime.QuadPart) * 1e-7 : 0.0;
+#elif defined(__linux__)
+	// Start time is the 22nd field of /proc/self/stat, in clock ticks since boot. The name before it can hold spaces, so count from its closing bracket.
+	FILE* file = fopen("/proc/self/stat", "r");
+
+	if (file == nullptr)
+		return 0.0;
+
+	char line[1024];
+	size_t length = fread(line, 1, sizeof(line) - 1, file);
+	fclose(file);
+	line[length] = '\0';
+
+	const char* fields = strrchr(line, ')');
+	unsigned long long startTicks = 0;
+
+	if (fields == nullptr || sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu", &startTicks) != 1)
+		return 0.0;
+
+	timespec time;
+
+	if (clock_gettime(CLOCK_BOOTTIME, &time) != 0)
+		return 0.0;
+
+	double age = time.tv_sec + time.tv_nsec * 1e-9 - (double)startTicks / sysconf(_SC_CLK_TCK);
+
+	return age > 0.0 ? age : 0.0;
+#else
+	return 0.0;
+#endif
+}
+
+void WaitUntilCounter(Uint64 target)
+{
+	Uint64 now = SDL_GetPerformanceCounter();
+
+	// Sleep in whole milliseconds while at least one fits before the spin margin
+	while (now < target)
+	{
+		double sleep = CounterToSeconds(target - now) - SPIN_SECONDS;
+
+		if (sleep < 0.001)
+			break;
+
+		SDL_Delay((Uint32)(sleep * 1000.0));
+		now = SDL_GetPerformanceCounter();
+	}
+
+	// Spin for the rest
+	while (now < target)
+		now = SDL_GetPerformanceCounter();
+}
+
+void RunningStats::Add(double sample)
+{
+	count++;
+
+	if (count == 1)
+	{
+		minimum = maximum = sample;
+	}
+	else
+	{
+		minimum = std::fmin(minimum, sample);
+		maximum = std::fmax(maximum, sample);
+	}
+
+	// Update the mean and squared deviations together, which stays accurate over long runs
+	double delta = sample - mean;
+	mean += delta / count;
+	squaredDeviations += delta * (sample - mean);
+}
+
+double RunningStats::StandardDeviation() const
+{
+	return std::sqrt(Variance());
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <SDL/SDL.h>
+
+// High resolution timing on top of SDL's performance counter
+double CounterToSeconds(Uint64 ticks); // convert a counter difference to seconds
+Uint64 SecondsToCounter(double seconds);
+
+// CPU time used by the whole process so far, every thread included
+double ProcessCPUSeconds();
+
+// Wall clock time since the process was created, or 0 if the platform can't tell. On Linux this is only as
+// fine as the kernel's clock tick, usually 10 ms.
+double ProcessAgeSeconds();
+
+// Wait until the performance counter reaches target. Sleeps while there is plenty of time left, as sleeps
+// can overshoot by a millisecond or more, then spins for the rest so the wake up is exact.
+void WaitUntilCounter(Uint64 target);
+
+// Struct to hold running statistics of a series of samples, without storing them (Welford's method)
+struct RunningStats
+{
+	unsigned int count = 0;
+	double mean = 0.0;
+	double squaredDeviations = 0.0; // sum of squared differences from the mean
+	double minimum = 0.0;
+	double maximum = 0.0;
+
+	void Add(double sample);
+	void Reset() { *this = RunningStats(); }
+	double Variance() const { return count > 1 ? squaredDeviations / (count - 1) : 0.0; }
+	double StandardDeviation() const;
+};
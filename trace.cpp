@@ -0,0 +1,179 @@
+#include "trace.h"
+
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <vector>
+
+#include "timing.h"
+
+// Events are stored in fixed size chunks, so recording never moves what is already there
+static const unsigned int TRACE_CHUNK_EVENTS = 4096;
+
+// Struct to hold one finished scope
+struct TraceEvent
+{
+	const char* name;
+	Uint64 begin, end;
+};
+
+// Struct to hold a chunk of one thread's events
+struct TraceChunk
+{
+	TraceEvent events[TRACE_CHUNK_EVENTS];
+	std::atomic<unsigned int> count; // events written, published after each write
+	TraceChunk* next = nullptr;
+
+	TraceChunk() : count(0) {}
+};
+
+// Struct to hold one thread's events. Only the owning thread writes to it.
+struct ThreadTrace
+{
+	unsigned int id = 0;
+	std::string name;
+	TraceChunk* first = nullptr;
+	TraceChunk* last = nullptr;
+};
+
+bool traceEnabled = false;
+static Uint64 traceStart = 0;
+
+// Every thread that has recorded anything. The lock is only taken the first time a thread records.
+static std::mutex traceThreadsMutex;
+static std::vector<ThreadTrace*> traceThreads;
+static thread_local ThreadTrace* localTrace = nullptr;
+
+// The calling thread's buffer, created and registered on first use
+static ThreadTrace* GetThreadTrace()
+{
+	if (localTrace == nullptr)
+	{
+		localTrace = new ThreadTrace();
+		localTrace->first = localTrace->last = new TraceChunk();
+
+		std::lock_guard<std::mutex> lock(traceThreadsMutex);
+		localTrace->id = traceThreads.size() + 1;
+		traceThreads.push_back(localTrace);
+	}
+
+	return localTrace;
+}
+
+// Write a string as a JSON string literal
+static void WriteJSONString(std::ofstream& file, const std::string& text)
+{
+	file << '"';
+
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+			file << '\\' << c;
+		else if ((unsigned char)c >= 0x20)
+			file << c;
+	}
+
+	file << '"';
+}
+
+void StartTrace()
+{
+	traceStart = SDL_GetPerformanceCounter();
+	traceEnabled = true;
+}
+
+void SetTraceThreadName(const std::string& name)
+{
+	if (traceEnabled)
+		GetThreadTrace()->name = name;
+}
+
+void RecordTraceEvent(const char* name, Uint64 begin, Uint64 end)
+{
+	ThreadTrace* trace = GetThreadTrace();
+	TraceChunk* chunk = trace->last;
+	unsigned int count = chunk->count.load(std::memory_order_relaxed);
+
+	// Start a new chunk when this one is full
+	if (count == TRACE_CHUNK_EVENTS)
+	{
+		chunk->next = new TraceChunk();
+		chunk = trace->last = chunk->next;
+		count = 0;
+	}
+
+	TraceEvent& event = chunk->events[count];
+	event.name = name;
+	event.begin = begin;
+	event.end = end;
+	chunk->count.store(count + 1, std::memory_order_release);
+}
+
+bool WriteTrace(const std::string& filename)
+{
+	std::ofstream file(filename.c_str());
+
+	if (!file)
+		return false;
+
+	// Complete ("X") events, with times in microseconds from the start of the trace
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+	file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Demo\"}}";
+
+	// Fixed point, so long traces keep sub-microsecond precision
+	file << std::fixed << std::setprecision(3);
+
+	std::lock_guard<std::mutex> lock(traceThreadsMutex);
+
+	for (const ThreadTrace* trace : traceThreads)
+	{
+		if (!trace->name.empty())
+		{
+			file << "," << std::endl << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << trace->id << ",\"args\":{\"name\":";
+			WriteJSONString(file, trace->name);
+			file << "}}";
+		}
+
+		for (const TraceChunk* chunk = trace->first; chunk != nullptr; chunk = chunk->next)
+		{
+			unsigned int count = chunk->count.load(std::memory_order_acquire);
+
+			for (unsigned int i = 0; i < count; i++)
+			{
+				const TraceEvent& event = chunk->events[i];
+				file << "," << std::endl << "{\"name\":";
+				WriteJSONString(file, event.name);
+				file << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << trace->id
+					<< ",\"ts\":" << CounterToSeconds(event.begin - traceStart) * 1000000.0
+					<< ",\"dur\":" << CounterToSeconds(event.end - event.begin) * 1000000.0 << "}";
+			}
+		}
+	}
+
+	file << std::endl << "]}" << std::endl;
+
+	return file.good();
+}
+
+void ClearTrace()
+{
+	std::lock_guard<std::mutex> lock(traceThreadsMutex);
+
+	for (ThreadTrace* trace : traceThreads)
+	{
+		TraceChunk* chunk = trace->first;
+
+		while (chunk != nullptr)
+		{
+			TraceChunk* next = chunk->next;
+			delete chunk;
+			chunk = next;
+		}
+
+		delete trace;
+	}
+
+	traceThreads.clear();
+	localTrace = nullptr;
+}
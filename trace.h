@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+
+#include <SDL/SDL.h>
+
+// CPU profiling. Scopes record their start and end on the performance counter into a buffer owned by
+// the calling thread, so recording takes no locks. At exit the events are written out in the Chrome
+// trace event format, to open in chrome://tracing or Perfetto.
+// Recording is off unless StartTrace is called, then a scope costs one test of a global flag.
+
+extern bool traceEnabled; // only set by StartTrace, read it through TraceEnabled
+
+inline bool TraceEnabled() { return traceEnabled; }
+
+void StartTrace(); // turn recording on, before any other thread is started
+void SetTraceThreadName(const std::string& name); // name the calling thread in the trace
+void RecordTraceEvent(const char* name, Uint64 begin, Uint64 end); // name must stay valid until the trace is written, use a literal
+bool WriteTrace(const std::string& filename); // write every thread's events, once they have all stopped recording. False if the file couldn't be written.
+void ClearTrace(); // free every thread's events, once no other thread is recording
+
+// Records the time between its construction and destruction
+class TraceScope
+{
+public:
+	explicit TraceScope(const char* name) : name(TraceEnabled() ? name : nullptr), begin(this->name != nullptr ? SDL_GetPerformanceCounter() : 0) {}
+	~TraceScope() { if (name != nullptr) RecordTraceEvent(name, begin, SDL_GetPerformanceCounter()); }
+
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+	const char* name;
+	Uint64 begin;
+};
+
+// Time the rest of the enclosing block
+#define TRACE_JOIN_NAME(a, b) a##b
+#define TRACE_SCOPE_NAME(line) TRACE_JOIN_NAME(traceScope, line)
+#define TRACE_SCOPE(name) TraceScope TRACE_SCOPE_NAME(__LINE__)(name)